@@ -1,16 +1,49 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <typeindex>
+#include <typeinfo>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define SHAREDPTR_HAS_COROUTINES 1
+#include <coroutine>
+#include <exception>
+#else
+#define SHAREDPTR_HAS_COROUTINES 0
+#endif
 
 
 namespace
 {
+    // the address of the most derived object, which pointers to any of its bases agree on
+    //
     template <typename DataT>
     void* convertToVoidPtr(DataT* data)
     {
@@ -19,277 +52,5713 @@ namespace
             throw std::logic_error{"SharedPtrDataManagementTable method called with null data"};
         }
 
-        return static_cast<void*>(data);
+        auto* mutableData = const_cast<std::remove_cv_t<DataT>*>(data);
+        if constexpr (std::is_polymorphic_v<DataT>)
+        {
+            return dynamic_cast<void*>(mutableData);
+        }
+        else
+        {
+            return static_cast<void*>(mutableData);
+        }
+    }
+
+    template <typename DataT>
+    void deleteData(void* data)
+    {
+        delete static_cast<DataT*>(data);
+    }
+
+    // deleters without state are only ever default constructed where they get called, so
+    // they need no storage besides their registry id
+    //
+    template <typename DeleterT>
+    constexpr bool IsStatelessDeleter = std::is_empty_v<DeleterT> && std::is_default_constructible_v<DeleterT>;
+
+    template <typename DataT, typename DeleterT>
+    void deleteDataWith(void* data)
+    {
+        DeleterT{}(static_cast<DataT*>(data));
+    }
+
+    // deletes data of a single type in a tight loop, the deleter being inlined instead of
+    // called through a pointer. for trivially destructible types this is nothing but the
+    // frees
+    //
+    template <void (*DeleterFunction)(void*)>
+    void deleteDataBatch(void* const* data, std::size_t count)
+    {
+        for (std::size_t dataIndex{0}; dataIndex < count; ++dataIndex)
+        {
+            DeleterFunction(data[dataIndex]);
+        }
     }
 }
 
 
-class SharedPtrDataManagementTable
+struct SharedPtrDomainPolicy
 {
-public:
-    static auto& GetInstance()
+    std::size_t initialCapacity{0};
+    bool allowBulkDestruction{true};
+    std::size_t shardCount{16};
+
+    // whether data whose last holder is on another thread than the one which adopted it
+    // gets deleted back on the adopting thread, so that thread-caching allocators see no
+    // remote frees. it waits there until that thread adopts again or calls
+    // SharedPtrDataManagementTable::DrainCreatorInbox(), or exits. like with deferDeletion,
+    // data with a deleter of its own is still deleted right away
+    //
+    bool returnToCreatorThread{false};
+
+    // whether the data of the domain gets deleted in batches grouped by deleter instead of
+    // one at a time, so that the destructors of each type run back to back. the last
+    // holders leave their data to a per-thread buffer, deleted once it holds
+    // SharedPtrConfig::deferredDeletionBatchSize of them, when the thread calls
+    // SharedPtrDataManagementTable::FlushDeferredDeletions(), or exits. data with a
+    // deleter of its own is still deleted right away. as it changes when destructors
+    // run, only domains created with this policy defer, the config can not turn it on
+    //
+    bool deferDeletion{false};
+};
+
+
+// process wide tuning, read once before the first table gets created, from the file named
+// by SHAREDPTR_CONFIG_FILE (NAME = value lines, # starting comments) and then from the
+// environment variables of the same names, which take precedence. nothing reads it again
+// afterwards, so changing it takes a restart but costs nothing on the hot paths
+//
+struct SharedPtrConfig
+{
+    SharedPtrDomainPolicy defaultPolicy{};
+    std::size_t holderSamplingRate{1};
+
+    // the memory pressure monitor trims once the share of the last 10 seconds some task
+    // spent stalled on memory reaches this many percent
+    //
+    std::size_t pressureThresholdPercent{10};
+    std::size_t pressurePollIntervalMs{1000};
+
+    // how many free coroutine frames each thread keeps per size class
+    //
+    std::size_t framePoolSize{64};
+
+    // whether MakeSharedPtr() allocates from the nursery, how many free nursery chunks are
+    // kept for reuse, and how much of every page threads keep for MakeSharedPtrNear() until
+    // they call SharedPtrNursery::SetNearReserveSize(). none by default, which leaves the
+    // hints of MakeSharedPtrNear() without effect
+    //
+    bool useNursery{false};
+    std::size_t nurseryPoolSize{16};
+    std::size_t nurseryNearReserveSize{0};
+
+    std::size_t deferredDeletionBatchSize{256};
+
+    static const SharedPtrConfig& Get()
     {
-        static SharedPtrDataManagementTable instance{};
-        return instance;
+        static const SharedPtrConfig config{Load()};
+        return config;
     }
 
-    template <typename DataT>
-    void addData(DataT* data)
+    static SharedPtrConfig Load()
     {
-        auto* voidData = convertToVoidPtr(data);
+        SharedPtrConfig config{};
+
+        if (const auto* fileName = std::getenv("SHAREDPTR_CONFIG_FILE"))
+        {
+            std::ifstream configFile{fileName};
+            if (!configFile)
+            {
+                throw std::invalid_argument{std::string{"SharedPtr config file "} + fileName + " cannot be read"};
+            }
+
+            std::string line;
+            while (std::getline(configFile, line))
+            {
+                line = trim(line.substr(0, line.find('#')));
+                if (line.empty())
+                {
+                    continue;
+                }
+
+                const auto separatorPosition = line.find('=');
+                if (separatorPosition == std::string::npos)
+                {
+                    throw std::invalid_argument{"malformed SharedPtr config line " + line};
+                }
+
+                config.apply(trim(line.substr(0, separatorPosition)), trim(line.substr(separatorPosition + 1)));
+            }
+        }
 
-        const auto findItr = m_managementTable.find(voidData);
-        if (findItr == m_managementTable.end())
+        for (const auto* settingName : SettingNames)
+        {
+            if (const auto* value = std::getenv(settingName))
+            {
+                config.apply(settingName, value);
+            }
+        }
+
+        return config;
+    }
+
+private:
+    static constexpr const char* SettingNames[]{"SHAREDPTR_INITIAL_CAPACITY",
+                                                "SHAREDPTR_SHARD_COUNT",
+                                                "SHAREDPTR_RETURN_TO_CREATOR_THREAD",
+                                                "SHAREDPTR_DEFERRED_DELETION_BATCH_SIZE",
+                                                "SHAREDPTR_HOLDER_SAMPLING_RATE",
+                                                "SHAREDPTR_PRESSURE_THRESHOLD_PERCENT",
+                                                "SHAREDPTR_PRESSURE_POLL_INTERVAL_MS",
+                                                "SHAREDPTR_FRAME_POOL_SIZE",
+                                                "SHAREDPTR_NURSERY",
+                                                "SHAREDPTR_NURSERY_POOL_SIZE",
+                                                "SHAREDPTR_NURSERY_NEAR_RESERVE_SIZE"};
+
+    void apply(const std::string& name, const std::string& value)
+    {
+        if (name == "SHAREDPTR_INITIAL_CAPACITY")
+        {
+            defaultPolicy.initialCapacity = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_SHARD_COUNT")
+        {
+            defaultPolicy.shardCount = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_RETURN_TO_CREATOR_THREAD")
+        {
+            defaultPolicy.returnToCreatorThread = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_DEFERRED_DELETION_BATCH_SIZE")
         {
-            m_managementTable.emplace(voidData, 1);
+            deferredDeletionBatchSize = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_HOLDER_SAMPLING_RATE")
+        {
+            holderSamplingRate = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_PRESSURE_THRESHOLD_PERCENT")
+        {
+            pressureThresholdPercent = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_PRESSURE_POLL_INTERVAL_MS")
+        {
+            pressurePollIntervalMs = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_FRAME_POOL_SIZE")
+        {
+            framePoolSize = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_NURSERY")
+        {
+            useNursery = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_NURSERY_POOL_SIZE")
+        {
+            nurseryPoolSize = parseSize(name, value);
+        }
+        else if (name == "SHAREDPTR_NURSERY_NEAR_RESERVE_SIZE")
+        {
+            nurseryNearReserveSize = parseSize(name, value);
         }
         else
         {
-            ++findItr->second;
+            throw std::invalid_argument{"unknown SharedPtr setting " + name};
         }
     }
 
-    template <typename DataT>
-    bool removeData(DataT* data)
+    static std::size_t parseSize(const std::string& name, const std::string& value)
     {
-        const auto findItr = m_managementTable.find(convertToVoidPtr(data));
-        if (findItr == m_managementTable.end())
+        std::size_t parsedLength{0};
+        unsigned long long parsedValue{0};
+        try
+        {
+            parsedValue = std::stoull(value, &parsedLength);
+        }
+        catch (const std::exception&)
         {
-            throw std::logic_error{"SharedPtrDataManagementTable::removeData called with non-managed data"};
+            parsedLength = 0;
         }
 
-        if (findItr->second.load() > 1)
+        if (value.empty() || (parsedLength != value.size()))
         {
-            --findItr->second;
-            return false;
+            throw std::invalid_argument{"SharedPtr setting " + name + " has invalid value " + value};
         }
 
-        m_managementTable.erase(findItr);
-        return true;
+        return static_cast<std::size_t>(parsedValue);
     }
 
-    template <typename DataT>
-    std::size_t getCount(DataT* data) const
+    static std::string trim(const std::string& text)
     {
-        const auto findItr = m_managementTable.find(convertToVoidPtr(data));
-        if (findItr == m_managementTable.cend())
+        const auto begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
         {
-            return 0;
+            return {};
         }
 
-        return findItr->second.load();
+        return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
     }
+};
 
-private:
-    using ManagementTable = std::unordered_map<void*, std::atomic_size_t>;
-    ManagementTable m_managementTable;
 
-    SharedPtrDataManagementTable() = default;
+// summed over the shards of a domain, so peakLiveCount is an upper bound of the real peak
+//
+struct SharedPtrDomainStats
+{
+    std::size_t adoptedCount{0};
+    std::size_t releasedCount{0};
+    std::size_t bulkDestroyedCount{0};
+    std::size_t liveCount{0};
+    std::size_t peakLiveCount{0};
 };
 
 
-template <typename DataT>
-class SharedPtr
+// a blocked counting bloom filter over the managed addresses: both counters of an
+// address live in the same 64-byte block, so answering "definitely not managed" costs a
+// single cache line instead of a hash table probe. saturated counters stay saturated,
+// which only makes the filter a little less precise. it is only changed under the lock
+// of its shard, but mayContain() may be called without it: the counters are atomic, and
+// the blocks a filter grows out of are kept until it is destroyed, as readers may still
+// be looking at them. growing doubles them, so that keeps it under twice its size
+//
+class SharedPtrPresenceFilter
 {
 public:
-    using Data = DataT;
+    SharedPtrPresenceFilter()
+    {
+        m_blockArrays.push_back(std::make_unique<BlockArray>(MinBlockCount));
+        m_blockArray.store(m_blockArrays.back().get(), std::memory_order_release);
+    }
 
-    explicit SharedPtr(DataT* data)
-    : m_data{data},
-      m_managementTableRef{SharedPtrDataManagementTable::GetInstance()}
+    SharedPtrPresenceFilter(const SharedPtrPresenceFilter&) = delete;
+    SharedPtrPresenceFilter& operator=(const SharedPtrPresenceFilter&) = delete;
+    SharedPtrPresenceFilter(SharedPtrPresenceFilter&&) = delete;
+    SharedPtrPresenceFilter& operator=(SharedPtrPresenceFilter&&) = delete;
+
+    void insert(const void* data)
     {
-        if (m_data)
-        {
-            m_managementTableRef.addData(m_data);
-        }
+        Insert(*m_blockArrays.back(), data);
     }
-    
-    SharedPtr()
-    : SharedPtr{static_cast<DataT*>(nullptr)}
+
+    void erase(const void* data)
     {
-        
+        auto& block = m_blockArrays.back()->getBlock(data);
+        for (const auto position : getPositions(data))
+        {
+            const auto counter = block[position].load(std::memory_order_relaxed);
+            if (counter != SaturatedCounter)
+            {
+                block[position].store(counter - 1, std::memory_order_relaxed);
+            }
+        }
     }
 
-    explicit SharedPtr(std::nullptr_t)
-    : SharedPtr{}
+    // may race with the changes, answering for data some other thread is adding or
+    // removing either way. data the calling thread knows to be managed is always found
+    //
+    bool mayContain(const void* data) const
     {
+        const auto& block = m_blockArray.load(std::memory_order_acquire)->getBlock(data);
+        for (const auto position : getPositions(data))
+        {
+            if (!block[position].load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+        }
 
+        return true;
     }
 
-    SharedPtr(const SharedPtr<DataT>& other)
-    : SharedPtr{other.m_data}
+    // replaces the blocks by blockCount ones, rounded up to a power of two, holding the
+    // addresses forEachData(callback) calls callback(const void* data) with
+    //
+    template <typename ForEachDataT>
+    void rebuild(std::size_t blockCount, ForEachDataT&& forEachData)
     {
+        auto blockArray = std::make_unique<BlockArray>(blockCount);
+        forEachData([&blockArray](const void* data)
+        {
+            Insert(*blockArray, data);
+        });
 
+        m_blockArrays.push_back(std::move(blockArray));
+        m_blockArray.store(m_blockArrays.back().get(), std::memory_order_release);
     }
 
-    SharedPtr(SharedPtr<DataT>&& other) noexcept
-    : m_data{other.m_data},
-      m_managementTableRef{SharedPtrDataManagementTable::GetInstance()}
+    // a filter keeps its precision up to about this many addresses
+    //
+    std::size_t getCapacity() const
     {
-        other.m_data = nullptr;
+        return getBlockCount() * AddressesPerBlock;
     }
 
-    template <typename DataU, typename = std::enable_if_t<std::is_base_of_v<DataT, DataU> ||
-                                                          std::is_base_of_v<DataU, DataT>>>
-    SharedPtr(DataU* data)
-    : SharedPtr{(std::is_base_of_v<DataT, DataU>) ? static_cast<DataT*>(data) 
-                                                  : dynamic_cast<DataT*>(data)}
+    std::size_t getBlockCount() const
     {
-
+        return m_blockArrays.back()->blockCount;
     }
 
-    template <typename DataU>
-    SharedPtr(const SharedPtr<DataU>& other)
-    : SharedPtr{other.m_data}
+    static constexpr std::size_t CountersPerBlock{64};
+    static constexpr std::size_t CountersPerAddress{2};
+
+    // with this many addresses per block, about one in twenty lookups of data which is not
+    // managed still gets past the filter
+    //
+    static constexpr std::size_t AddressesPerBlock{8};
+
+private:
+    static constexpr std::size_t MinBlockCount{64};
+    static constexpr std::uint8_t SaturatedCounter{0xFF};
+
+    struct alignas(64) Block : std::array<std::atomic<std::uint8_t>, CountersPerBlock>
     {
+    };
 
-    }
+    struct BlockArray
+    {
+        const std::size_t blockCount;
+        const std::unique_ptr<Block[]> blocks;
 
-    SharedPtr<DataT>& operator=(const SharedPtr<DataT>& other)
+        explicit BlockArray(std::size_t minBlockCount)
+        : blockCount{roundUpToPowerOfTwo(minBlockCount)},
+          blocks{new Block[blockCount]()}
+        {
+
+        }
+
+        Block& getBlock(const void* data) const
+        {
+            return blocks[(hash(data) >> 32) & (blockCount - 1)];
+        }
+    };
+
+    // the current one is the last
+    //
+    std::vector<std::unique_ptr<BlockArray>> m_blockArrays;
+    std::atomic<const BlockArray*> m_blockArray{nullptr};
+
+    static void Insert(BlockArray& blockArray, const void* data)
     {
-        assignSelf(other);
-        return *this;
+        auto& block = blockArray.getBlock(data);
+        for (const auto position : getPositions(data))
+        {
+            const auto counter = block[position].load(std::memory_order_relaxed);
+            if (counter != SaturatedCounter)
+            {
+                block[position].store(counter + 1, std::memory_order_relaxed);
+            }
+        }
     }
 
-    SharedPtr<DataT>& operator=(SharedPtr<DataT>&& other) noexcept
+    static std::size_t roundUpToPowerOfTwo(std::size_t value)
     {
-        assignSelf(std::move(other));
-        return *this;
+        std::size_t result{MinBlockCount};
+        while (result < value)
+        {
+            result *= 2;
+        }
+
+        return result;
     }
 
-    template <typename DataU>
-    SharedPtr<DataT>& operator=(const SharedPtr<DataU>& other)
+    static std::uint64_t hash(const void* data)
     {
-        assignSelf(other);
-        return *this;
+        return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(data)) * 0x9E3779B97F4A7C15ull;
     }
 
-    template <typename DataU>
-    SharedPtr<DataT>& operator=(SharedPtr<DataU>&& other) noexcept
+    static std::array<std::size_t, CountersPerAddress> getPositions(const void* data)
     {
-        assignSelf(std::move(other));
-        return *this;
+        const auto dataHash = hash(data);
+        return {(dataHash >> 58) & (CountersPerBlock - 1), (dataHash >> 52) & (CountersPerBlock - 1)};
     }
+};
 
-    ~SharedPtr()
+
+// deleters are stored in the table entries as small ids into this registry, which each
+// deleting type registers itself into once
+//
+class SharedPtrDeleterRegistry
+{
+public:
+    using Deleter = void (*)(void*);
+    using BatchDeleter = void (*)(void* const*, std::size_t);
+    using DeleterId = std::uint16_t;
+
+    static constexpr DeleterId NoDeleterId{0};
+
+    // entries with this id are deleted by a stateful deleter the table keeps for each of them
+    //
+    static constexpr DeleterId CustomDeleterId{1};
+
+    // only data deleted by its own delete gets a batch deleter, which is what lets its
+    // deletion be deferred. the deleters of GetFunctionId() and the custom ones close
+    // handles and the like, which must not wait
+    //
+    template <typename DataT>
+    static DeleterId GetId()
     {
-        releaseData(true);
+        static const DeleterId id{Register(&deleteData<DataT>, &deleteDataBatch<&deleteData<DataT>>)};
+        return id;
     }
 
-    void release()
+    template <Deleter DeleterFunction>
+    static DeleterId GetFunctionId()
     {
-        releaseData(false);
+        static const DeleterId id{Register(DeleterFunction)};
+        return id;
     }
 
-    DataT* operator->()
+    static DeleterId Register(Deleter deleter, BatchDeleter batchDeleter = nullptr)
     {
-        throwIfInvalidAccess();
+        const auto id = GetNextId().fetch_add(1, std::memory_order_relaxed);
+        if (id >= MaxDeleterCount)
+        {
+            throw std::length_error{"SharedPtrDeleterRegistry is full"};
+        }
 
-        return m_data;
+        GetDeleters()[id] = deleter;
+        GetBatchDeleters()[id] = batchDeleter;
+        return static_cast<DeleterId>(id);
     }
 
-    const DataT* operator->() const
+    static Deleter Get(DeleterId id)
     {
-        return const_cast<SharedPtr<DataT>&>(*this).operator->();
+        return GetDeleters()[id];
     }
 
-    DataT& operator*()
+    static BatchDeleter GetBatch(DeleterId id)
     {
-        throwIfInvalidAccess();
-
-        return *m_data;
+        return GetBatchDeleters()[id];
     }
 
-    const DataT& operator*() const
+private:
+    static constexpr std::size_t MaxDeleterCount{4096};
+
+    static std::array<Deleter, MaxDeleterCount>& GetDeleters()
     {
-        return *const_cast<SharedPtr<DataT>&>(*this);
+        static std::array<Deleter, MaxDeleterCount> deleters{};
+        return deleters;
     }
 
-    operator bool() const
+    static std::array<BatchDeleter, MaxDeleterCount>& GetBatchDeleters()
     {
-        return m_data;
+        static std::array<BatchDeleter, MaxDeleterCount> batchDeleters{};
+        return batchDeleters;
     }
 
-    std::size_t getUseCount() const
+    static std::atomic_size_t& GetNextId()
     {
-        if (!m_data)
-        {
-            return 0;
-        }
-
-        return m_managementTableRef.getCount(m_data);
+        static std::atomic_size_t nextId{CustomDeleterId + 1};
+        return nextId;
     }
+};
 
-    template<typename> friend class SharedPtr;
 
-private:
-    DataT* m_data;
-    SharedPtrDataManagementTable& m_managementTableRef;
+// an open addressing table of packed 8-byte entries: the 48-bit address of the data and
+// its 16-bit count share one word, so a count update is a single plain store to it. the
+// table does not synchronize anything itself: every access is made under the mutex of the
+// shard owning it, or by the thread owning a thread-local table, and the holder that
+// brings a count to zero thereby sees every write the other holders made before theirs.
+// the rare counts that do not fit are spilled into a side table, and the deleter ids of
+// the entries are kept in a parallel array, as are the pointers the tables which enable
+// them attach to their entries. every thread remembers the slots it found
+// last in a small direct-mapped cache. a remembered slot is checked against the address
+// its word holds on every hit, so erasing or shifting other entries leaves it valid, and
+// only a rehash, which moves every entry, changes the table's generation
+//
+class SharedPtrPackedEntryTable
+{
+public:
+    using DeleterId = SharedPtrDeleterRegistry::DeleterId;
 
-    template <typename SharedPtrT>
-    void assignSelf(SharedPtrT&& other)
+    static constexpr std::size_t NotFound{static_cast<std::size_t>(-1)};
+
+    SharedPtrPackedEntryTable() = default;
+
+    SharedPtrPackedEntryTable(const SharedPtrPackedEntryTable&) = delete;
+    SharedPtrPackedEntryTable& operator=(const SharedPtrPackedEntryTable&) = delete;
+    SharedPtrPackedEntryTable(SharedPtrPackedEntryTable&&) = delete;
+    SharedPtrPackedEntryTable& operator=(SharedPtrPackedEntryTable&&) = delete;
+
+    std::size_t find(const void* data) const
     {
-        using DataU = typename std::remove_reference_t<std::remove_cv_t<SharedPtrT>>::Data;
+        if (!m_size)
+        {
+            return NotFound;
+        }
 
-        static_assert(std::is_base_of_v<DataT, DataU>,
-                      "SharedPtr may only be assigned to SharedPtr<derived from this one's DataT>");
+        auto& cacheEntry = GetLookupCache()[(reinterpret_cast<std::uintptr_t>(data) >> 4) &
+                                            (LookupCacheSize - 1)];
+        const auto address = toAddress(data);
+        if ((cacheEntry.data == data) && (cacheEntry.tableId == m_id) && (cacheEntry.generation == m_generation) &&
+            ((m_words[cacheEntry.slot] >> CountBits) == address))
+        {
+            return cacheEntry.slot;
+        }
 
-        if constexpr (std::is_same_v<DataT, DataU>)
+        for (auto slot = getHomeSlot(address); ; slot = getNextSlot(slot))
         {
-            if (this == &other)
+            const auto word = m_words[slot];
+            if (!word)
             {
-                return;
+                return NotFound;
             }
-        }
-
-        releaseData(true);
 
-        m_data = other.m_data;
-        assignSelfContinuation(std::forward<SharedPtrT>(other));
+            if ((word >> CountBits) == address)
+            {
+                cacheEntry = LookupCacheEntry{m_id, m_generation, data, slot};
+                return slot;
+            }
+        }
     }
 
-    template <typename DataU>
-    void assignSelfContinuation(const SharedPtr<DataU>&)
+    // returns the slot of data and whether it was inserted by this call
+    //
+    std::pair<std::size_t, bool> tryEmplace(const void* data, std::size_t count, DeleterId deleterId)
     {
-        m_managementTableRef.addData(m_data);
-    }
+        const auto foundSlot = find(data);
+        if (foundSlot != NotFound)
+        {
+            return {foundSlot, false};
+        }
 
-    template <typename DataU>
-    void assignSelfContinuation(SharedPtr<DataU>&& other)
-    {
-        other.m_data = nullptr;
-    }
+        const auto address = toAddress(data);
+        if ((m_size + 1) * MaxLoadDenominator > m_slotCount * MaxLoadNumerator)
+        {
+            rehash(std::max(MinSlotCount, m_slotCount * 2));
+        }
 
-    void releaseData(bool deleteIfLast)
-    {
-        if (m_data && m_managementTableRef.removeData(m_data) && deleteIfLast)
+        auto slot = getHomeSlot(address);
+        while (m_words[slot])
         {
-            delete m_data;
+            slot = getNextSlot(slot);
         }
 
-        m_data = nullptr;
+        storeCount(slot, address, count);
+        m_deleterIds[slot] = deleterId;
+        if (m_attachments)
+        {
+            m_attachments[slot] = nullptr;
+        }
+
+        ++m_size;
+
+        return {slot, true};
     }
 
-    void throwIfInvalidAccess() const
+    void eraseAt(std::size_t slot)
     {
-        if (!m_data)
+        const auto word = m_words[slot];
+        if ((word & CountMask) == OverflowCount)
         {
-            throw std::logic_error{"SharedPtr dereferenced with null managed data"};
+            m_overflowCounts.erase(word >> CountBits);
         }
-    }
-};
 
+        // backward shift deletion, so the table never needs tombstones
+        //
+        auto hole = slot;
+        for (auto next = getNextSlot(hole); ; next = getNextSlot(next))
+        {
+            const auto nextWord = m_words[next];
+            if (!nextWord)
+            {
+                break;
+            }
 
-template <typename DataT, typename... ArgsT>
-SharedPtr<DataT> MakeSharedPtr(ArgsT&&... args)
-{
-    return SharedPtr<DataT>{new DataT{std::forward<ArgsT>(args)...}};
-}
+            const auto homeSlot = getHomeSlot(nextWord >> CountBits);
+            if (((next - homeSlot) & (m_slotCount - 1)) >= ((next - hole) & (m_slotCount - 1)))
+            {
+                m_words[hole] = nextWord;
+                m_deleterIds[hole] = m_deleterIds[next];
+                if (m_attachments)
+                {
+                    m_attachments[hole] = m_attachments[next];
+                }
 
+                hole = next;
+            }
+        }
 
-class Base
-{
+        m_words[hole] = 0;
+        m_deleterIds[hole] = SharedPtrDeleterRegistry::NoDeleterId;
+        if (m_attachments)
+        {
+            m_attachments[hole] = nullptr;
+        }
+
+        --m_size;
+    }
+
+    std::size_t getCount(std::size_t slot) const
+    {
+        const auto word = m_words[slot];
+        if ((word & CountMask) == OverflowCount)
+        {
+            return m_overflowCounts.at(word >> CountBits);
+        }
+
+        return word & CountMask;
+    }
+
+    void incrementCount(std::size_t slot, std::size_t increment)
+    {
+        const auto word = m_words[slot];
+        if ((word & CountMask) + increment < OverflowCount)
+        {
+            m_words[slot] = word + increment;
+            return;
+        }
+
+        storeCount(slot, word >> CountBits, getCount(slot) + increment);
+    }
+
+    // returns the count left, the caller owning the data exclusively when it is zero
+    //
+    std::size_t decrementCount(std::size_t slot)
+    {
+        const auto word = m_words[slot];
+        if ((word & CountMask) == OverflowCount)
+        {
+            const auto count = getCount(slot) - 1;
+            storeCount(slot, word >> CountBits, count);
+            return count;
+        }
+
+        m_words[slot] = word - 1;
+        return (word & CountMask) - 1;
+    }
+
+    DeleterId getDeleterId(std::size_t slot) const
+    {
+        return m_deleterIds[slot];
+    }
+
+    void setDeleterId(std::size_t slot, DeleterId deleterId)
+    {
+        m_deleterIds[slot] = deleterId;
+    }
+
+    // gives every entry a pointer of its own from now on, null until set, which moves
+    // along with the entry. the tables which never call this pay nothing for it
+    //
+    void enableAttachments()
+    {
+        m_hasAttachments = true;
+        if (m_slotCount && !m_attachments)
+        {
+            m_attachments.reset(new void*[m_slotCount]());
+        }
+    }
+
+    void* getAttachment(std::size_t slot) const
+    {
+        return m_attachments ? m_attachments[slot] : nullptr;
+    }
+
+    // only once enableAttachments() was called
+    //
+    void setAttachment(std::size_t slot, void* attachment)
+    {
+        m_attachments[slot] = attachment;
+    }
+
+    // callback(void* data, std::size_t count, DeleterId& deleterId)
+    //
+    template <typename CallbackT>
+    void forEach(CallbackT&& callback)
+    {
+        for (std::size_t slot{0}; slot < m_slotCount; ++slot)
+        {
+            const auto word = m_words[slot];
+            if (word)
+            {
+                callback(toData(word >> CountBits), getCount(slot), m_deleterIds[slot]);
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    void reserve(std::size_t count)
+    {
+        auto slotCount = std::max(MinSlotCount, m_slotCount);
+        while (count * MaxLoadDenominator > slotCount * MaxLoadNumerator)
+        {
+            slotCount *= 2;
+        }
+
+        if (slotCount != m_slotCount)
+        {
+            rehash(slotCount);
+        }
+    }
+
+    // gives back the slots the table grew to but does not need anymore, returning about
+    // how many bytes that released
+    //
+    std::size_t shrinkToFit()
+    {
+        const auto previousSlotCount = m_slotCount;
+        if (!m_size)
+        {
+            m_words.reset();
+            m_deleterIds.reset();
+            m_attachments.reset();
+            m_slotCount = 0;
+            ++m_generation;
+        }
+        else
+        {
+            auto slotCount = MinSlotCount;
+            while (m_size * MaxLoadDenominator > slotCount * MaxLoadNumerator)
+            {
+                slotCount *= 2;
+            }
+
+            if (slotCount < m_slotCount)
+            {
+                rehash(slotCount);
+            }
+        }
+
+        if (m_overflowCounts.empty())
+        {
+            OverflowCountTable{}.swap(m_overflowCounts);
+        }
+
+        return (previousSlotCount - m_slotCount) *
+               (sizeof(std::uint64_t) + sizeof(DeleterId) + (m_hasAttachments ? sizeof(void*) : 0));
+    }
+
+private:
+    static constexpr unsigned CountBits{16};
+    static constexpr unsigned AddressBits{48};
+    static constexpr std::uint64_t CountMask{(std::uint64_t{1} << CountBits) - 1};
+    static constexpr std::uint64_t OverflowCount{CountMask};
+    static constexpr std::size_t MinSlotCount{16};
+    static constexpr std::size_t MaxLoadNumerator{3};
+    static constexpr std::size_t MaxLoadDenominator{4};
+
+    static constexpr std::size_t LookupCacheSize{64};
+
+    struct LookupCacheEntry
+    {
+        std::uint64_t tableId;
+        std::uint64_t generation;
+        const void* data;
+        std::size_t slot;
+    };
+
+    std::unique_ptr<std::uint64_t[]> m_words;
+    std::unique_ptr<DeleterId[]> m_deleterIds;
+    std::unique_ptr<void*[]> m_attachments;
+    bool m_hasAttachments{false};
+    std::size_t m_slotCount{0};
+    std::size_t m_size{0};
+
+    // ids are never reused, unlike addresses of tables, so no cache entry can outlive its table
+    //
+    const std::uint64_t m_id{GetNextTableId().fetch_add(1, std::memory_order_relaxed)};
+    std::uint64_t m_generation{0};
+
+    using OverflowCountTable = std::unordered_map<std::uint64_t, std::size_t>;
+    OverflowCountTable m_overflowCounts;
+
+    static std::array<LookupCacheEntry, LookupCacheSize>& GetLookupCache()
+    {
+        thread_local std::array<LookupCacheEntry, LookupCacheSize> lookupCache{};
+        return lookupCache;
+    }
+
+    static std::atomic<std::uint64_t>& GetNextTableId()
+    {
+        static std::atomic<std::uint64_t> nextTableId{1};
+        return nextTableId;
+    }
+
+    static std::uint64_t toAddress(const void* data)
+    {
+        const auto address = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(data));
+        if (address >> AddressBits)
+        {
+            throw std::logic_error{"SharedPtrPackedEntryTable supports 48-bit addresses only"};
+        }
+
+        return address;
+    }
+
+    static void* toData(std::uint64_t address)
+    {
+        return reinterpret_cast<void*>(static_cast<std::uintptr_t>(address));
+    }
+
+    std::size_t getHomeSlot(std::uint64_t address) const
+    {
+        address ^= address >> 33;
+        address *= 0xFF51AFD7ED558CCDull;
+        address ^= address >> 33;
+
+        return static_cast<std::size_t>(address) & (m_slotCount - 1);
+    }
+
+    std::size_t getNextSlot(std::size_t slot) const
+    {
+        return (slot + 1) & (m_slotCount - 1);
+    }
+
+    void storeCount(std::size_t slot, std::uint64_t address, std::size_t count)
+    {
+        if (count < OverflowCount)
+        {
+            m_overflowCounts.erase(address);
+            m_words[slot] = (address << CountBits) | count;
+            return;
+        }
+
+        m_overflowCounts[address] = count;
+        m_words[slot] = (address << CountBits) | OverflowCount;
+    }
+
+    void rehash(std::size_t slotCount)
+    {
+        auto words = std::move(m_words);
+        auto deleterIds = std::move(m_deleterIds);
+        auto attachments = std::move(m_attachments);
+        const auto previousSlotCount = std::exchange(m_slotCount, slotCount);
+        ++m_generation;
+
+        m_words.reset(new std::uint64_t[slotCount]());
+        m_deleterIds.reset(new DeleterId[slotCount]());
+        if (m_hasAttachments)
+        {
+            m_attachments.reset(new void*[slotCount]());
+        }
+
+        for (std::size_t previousSlot{0}; previousSlot < previousSlotCount; ++previousSlot)
+        {
+            const auto word = words[previousSlot];
+            if (!word)
+            {
+                continue;
+            }
+
+            auto slot = getHomeSlot(word >> CountBits);
+            while (m_words[slot])
+            {
+                slot = getNextSlot(slot);
+            }
+
+            m_words[slot] = word;
+            m_deleterIds[slot] = deleterIds[previousSlot];
+            if (attachments)
+            {
+                m_attachments[slot] = attachments[previousSlot];
+            }
+        }
+    }
+};
+
+
+class SharedPtrDataManagementTable;
+
+template <typename DataT>
+SharedPtrDataManagementTable& GetSharedPtrDomainOf(DataT* data);
+
+
+// receives the lifecycle events of every table, in builds defining
+// SHAREDPTR_LIFECYCLE_LISTENER, so that profilers and metric exporters can follow them
+// without patching the tables. other builds do not even look for a listener, and an
+// installed one costs a load and a virtual call per event. data is the address of the
+// most derived object; re-adopting managed data counts as a copy, moves are no events.
+// the events may be delivered under the lock of the table, so listeners must not use its
+// SharedPtrs
+//
+class SharedPtrLifecycleListener
+{
+public:
+    virtual ~SharedPtrLifecycleListener() = default;
+
+    virtual void onAdopt(const SharedPtrDataManagementTable& /* table */, const void* /* data */)
+    {
+
+    }
+
+    virtual void onCopy(const SharedPtrDataManagementTable& /* table */, const void* /* data */)
+    {
+
+    }
+
+    virtual void onRelease(const SharedPtrDataManagementTable& /* table */, const void* /* data */)
+    {
+
+    }
+
+    // before the data gets deleted, by its last holder or by destroyAllData()
+    //
+    virtual void onDelete(const SharedPtrDataManagementTable& /* table */, const void* /* data */)
+    {
+
+    }
+
+    // nullptr uninstalls. a listener has to outlive the events already being delivered
+    // to it, which is up to the caller
+    //
+    static void Install(SharedPtrLifecycleListener* listener)
+    {
+        GetInstalledListener().store(listener, std::memory_order_release);
+    }
+
+    static SharedPtrLifecycleListener* GetInstalled()
+    {
+        return GetInstalledListener().load(std::memory_order_acquire);
+    }
+
+private:
+    static std::atomic<SharedPtrLifecycleListener*>& GetInstalledListener()
+    {
+        static std::atomic<SharedPtrLifecycleListener*> installedListener{nullptr};
+        return installedListener;
+    }
+};
+
+
+// a type joins a family by declaring `using SharedPtrFamilyRoot = RootT;`, which its
+// derived types inherit, so Base and Derived pointers to the same data always resolve
+// to the root's table
+//
+template <typename DataT, typename = void>
+struct SharedPtrFamilyRootOf
+{
+    using Type = void;
+};
+
+template <typename DataT>
+struct SharedPtrFamilyRootOf<DataT, std::void_t<typename DataT::SharedPtrFamilyRoot>>
+{
+    using Type = typename DataT::SharedPtrFamilyRoot;
+
+    static_assert(std::is_base_of_v<Type, DataT>, "SharedPtrFamilyRoot must be a base of the type declaring it");
+};
+
+
+// every SharedPtrDataManagementTable is an independent ownership domain: the default
+// one is GetInstance(), named ones are created on first use by GetDomain(). entries are
+// keyed by the address of the most derived object, and each one remembers how to delete
+// its data so that a whole domain can be torn down at once.
+// all the tables are safe to use concurrently, locking one of their shards per call,
+// except the thread-local ones which are not synchronized at all and may only be used by
+// the thread that owns them
+//
+class SharedPtrDataManagementTable
+{
+public:
+    using Deleter = SharedPtrDeleterRegistry::Deleter;
+    using DeleterId = SharedPtrDeleterRegistry::DeleterId;
+    using CustomDeleter = std::function<void(void*)>;
+
+    static auto& GetInstance()
+    {
+        static SharedPtrDataManagementTable instance{"default", SharedPtrConfig::Get().defaultPolicy};
+        return instance;
+    }
+
+    // the policy is only applied by the call which creates the domain
+    //
+    static SharedPtrDataManagementTable& GetDomain(const std::string& name,
+                                                   const SharedPtrDomainPolicy& policy = SharedPtrConfig::Get().defaultPolicy)
+    {
+        if (name == GetInstance().getName())
+        {
+            return GetInstance();
+        }
+
+        static std::mutex registryMutex;
+        static std::map<std::string, std::unique_ptr<SharedPtrDataManagementTable>> registry;
+
+        const std::lock_guard<std::mutex> lock{registryMutex};
+
+        auto& domain = registry[name];
+        if (!domain)
+        {
+            domain.reset(new SharedPtrDataManagementTable{name, policy});
+        }
+
+        return *domain;
+    }
+
+    // a separate domain per type family, living in template static storage so that
+    // finding it costs nothing at runtime
+    //
+    template <typename FamilyRootT>
+    static auto& GetFamilyInstance()
+    {
+        static SharedPtrDataManagementTable instance{std::string{"family:"} + typeid(FamilyRootT).name(),
+                                                     SharedPtrConfig::Get().defaultPolicy};
+        return instance;
+    }
+
+    // what is known about a most derived type: the family table its data goes to once it
+    // was adopted through a type of its family, and whether data of it was adopted in the
+    // default domain through a base from outside of the family, before or without that
+    //
+    struct FamilyType
+    {
+        SharedPtrDataManagementTable* table;
+        bool wasAdoptedOutsideFamily;
+    };
+
+    // lock-free, from the immutable snapshot of the known types published last, remembering
+    // the last answer per thread for as long as no other snapshot gets published
+    //
+    static const FamilyType* FindFamilyType(const std::type_info& mostDerivedType)
+    {
+        const auto* familyTypeTable = GetFamilyTypes().published.load(std::memory_order_acquire);
+        if (!familyTypeTable)
+        {
+            return nullptr;
+        }
+
+        thread_local const FamilyTypeTable* lastTable{nullptr};
+        thread_local const std::type_info* lastType{nullptr};
+        thread_local const FamilyType* lastFamilyType{nullptr};
+
+        if ((lastTable != familyTypeTable) || !lastType || (*lastType != mostDerivedType))
+        {
+            const auto familyTypeItr = familyTypeTable->find(mostDerivedType);
+            lastTable = familyTypeTable;
+            lastType = &mostDerivedType;
+            lastFamilyType = (familyTypeItr != familyTypeTable->cend()) ? &familyTypeItr->second : nullptr;
+        }
+
+        return lastFamilyType;
+    }
+
+    // called on every adoption through a DataT pointer, before any shard gets locked, as
+    // it may create the family table. once the type is known that costs a lookup in the
+    // published snapshot only
+    //
+    template <typename DataT>
+    static void RegisterFamilyType(DataT* data)
+    {
+        using FamilyRoot = typename SharedPtrFamilyRootOf<std::remove_cv_t<DataT>>::Type;
+
+        if constexpr (!std::is_void_v<FamilyRoot> && std::is_polymorphic_v<DataT>)
+        {
+            const auto& mostDerivedType = typeid(*data);
+            const auto* familyType = FindFamilyType(mostDerivedType);
+            if (!familyType || !familyType->table)
+            {
+                auto& familyTable = GetFamilyInstance<FamilyRoot>();
+                PublishFamilyType(mostDerivedType, FamilyType{&familyTable, false});
+            }
+        }
+    }
+
+    // called when polymorphic data goes to the default domain for lack of a known family,
+    // so that its type keeps checking there once it turns out to have one
+    //
+    static void RegisterAdoptionOutsideFamily(const std::type_info& mostDerivedType)
+    {
+        if (!FindFamilyType(mostDerivedType))
+        {
+            PublishFamilyType(mostDerivedType, FamilyType{nullptr, true});
+        }
+    }
+
+    // a table for data that stays on the creating thread, used without any locking.
+    // SharedPtrs into it must be converted with SharedPtr::shareAcrossThreads() before
+    // reaching other threads, which migrates the entry into the domain adopting the raw
+    // data would pick. using the table from another thread throws, except for releasing
+    // SharedPtrs, which can not throw from their destructors and aborts
+    //
+    static auto& GetThreadLocalInstance()
+    {
+        thread_local SharedPtrDataManagementTable instance{"thread-local",
+                                                           SharedPtrConfig::Get().defaultPolicy,
+                                                           std::this_thread::get_id()};
+        return instance;
+    }
+
+    SharedPtrDataManagementTable(const SharedPtrDataManagementTable&) = delete;
+    SharedPtrDataManagementTable& operator=(const SharedPtrDataManagementTable&) = delete;
+    SharedPtrDataManagementTable(SharedPtrDataManagementTable&&) = delete;
+    SharedPtrDataManagementTable& operator=(SharedPtrDataManagementTable&&) = delete;
+
+    ~SharedPtrDataManagementTable()
+    {
+        if (!isThreadLocal())
+        {
+            auto& sharedTables = GetSharedTables();
+            const std::lock_guard<std::mutex> lock{sharedTables.mutex};
+
+            sharedTables.tables.erase(std::remove(sharedTables.tables.begin(), sharedTables.tables.end(), this),
+                                      sharedTables.tables.end());
+        }
+    }
+
+    // trims every table but the thread-local ones, which only their own thread may trim
+    //
+    static std::size_t TrimAllDomains()
+    {
+        auto& sharedTables = GetSharedTables();
+        const std::lock_guard<std::mutex> lock{sharedTables.mutex};
+
+        std::size_t releasedBytes{0};
+        for (auto* table : sharedTables.tables)
+        {
+            releasedBytes += table->trim();
+        }
+
+        return releasedBytes;
+    }
+
+    // deletes the data other threads sent back to the calling thread, which adopted it in
+    // a domain returning data to its creator thread, and returns how much
+    //
+    static std::size_t DrainCreatorInbox()
+    {
+        auto* creatorInbox = CreatorInbox::FindForCurrentThread();
+        return creatorInbox ? creatorInbox->drain() : 0;
+    }
+
+    // deletes the data the calling thread left for deletion in domains deferring it, and
+    // returns how much
+    //
+    static std::size_t FlushDeferredDeletions()
+    {
+        auto* deferredDeletions = DeferredDeletions::GetForCurrentThread();
+        return deferredDeletions ? deferredDeletions->flush() : 0;
+    }
+
+    template <typename DataT>
+    void addData(DataT* data)
+    {
+        RegisterFamilyType(data);
+        addData(data, resolveKey(convertToVoidPtr(data)));
+    }
+
+    // key must be convertToVoidPtr(data), passed in by holders which already know it.
+    // adopting new data this way takes a RegisterFamilyType(data) call first
+    //
+    template <typename DataT>
+    void addData(DataT* data, void* key, std::size_t count = 1)
+    {
+        drainCreatorInbox();
+
+        auto& shard = getShard(key);
+        const auto lock = lockShard(shard);
+
+        if (!shard.migratedData.empty())
+        {
+            const auto migratedItr = shard.migratedData.find(key);
+            if (migratedItr != shard.migratedData.end())
+            {
+                migratedItr->second.localCount += count;
+                notifyLifecycleListener(&SharedPtrLifecycleListener::onCopy, key);
+                return;
+            }
+        }
+
+        const auto deleterId = SharedPtrDeleterRegistry::GetId<DataT>();
+
+        const auto [slot, isInserted] = shard.managementTable.tryEmplace(key, count, deleterId);
+        if (isInserted)
+        {
+            setAdoptionOffset(shard, key, getAdoptionOffset(data, key));
+            setCreatorInboxNode(shard, slot);
+            onDataInserted(shard, key);
+            notifyLifecycleListener(&SharedPtrLifecycleListener::onAdopt, key);
+            return;
+        }
+
+        shard.managementTable.incrementCount(slot, count);
+
+        // the entry outlived a destroyAllData() and the address was reused by new data
+        //
+        if (shard.managementTable.getDeleterId(slot) == SharedPtrDeleterRegistry::NoDeleterId)
+        {
+            shard.managementTable.setDeleterId(slot, deleterId);
+            setAdoptionOffset(shard, key, getAdoptionOffset(data, key));
+            setCreatorInboxNode(shard, slot);
+            notifyLifecycleListener(&SharedPtrLifecycleListener::onAdopt, key);
+            return;
+        }
+
+        notifyLifecycleListener(&SharedPtrLifecycleListener::onCopy, key);
+    }
+
+    // adopts data deleted by deleterId instead of its own delete, or by customDeleter when
+    // that is SharedPtrDeleterRegistry::CustomDeleterId. either one gets called with
+    // adoptedData, the pointer the data was adopted through
+    //
+    void addDataWithDeleter(void* key, void* adoptedData, DeleterId deleterId, CustomDeleter customDeleter = {})
+    {
+        drainCreatorInbox();
+
+        auto& shard = getShard(key);
+        const auto lock = lockShard(shard);
+
+        auto slot = shard.managementTable.find(key);
+        if (shard.migratedData.count(key) ||
+            ((slot != SharedPtrPackedEntryTable::NotFound) &&
+             (shard.managementTable.getDeleterId(slot) != SharedPtrDeleterRegistry::NoDeleterId)))
+        {
+            throw std::logic_error{"SharedPtrDataManagementTable::addDataWithDeleter called with already managed data"};
+        }
+
+        setCustomDeleter(shard, key, deleterId, std::move(customDeleter));
+
+        if (slot == SharedPtrPackedEntryTable::NotFound)
+        {
+            slot = shard.managementTable.tryEmplace(key, 1, deleterId).first;
+            onDataInserted(shard, key);
+        }
+        else
+        {
+            shard.managementTable.incrementCount(slot, 1);
+            shard.managementTable.setDeleterId(slot, deleterId);
+        }
+
+        setAdoptionOffset(shard, key, getAdoptionOffset(adoptedData, key));
+        setCreatorInboxNode(shard, slot);
+        notifyLifecycleListener(&SharedPtrLifecycleListener::onAdopt, key);
+    }
+
+    // returns whether the last holder went away, in which case the data gets deleted
+    // unless deleteIfLast is false
+    //
+    template <typename DataT>
+    bool removeData(DataT* data, bool deleteIfLast = true)
+    {
+        auto* voidData = convertToVoidPtr(data);
+        auto& shard = getShard(voidData);
+        auto lock = lockShardForRelease(shard);
+
+        const auto slot = shard.managementTable.find(voidData);
+        if (slot == SharedPtrPackedEntryTable::NotFound)
+        {
+            const auto migratedItr = shard.migratedData.find(voidData);
+            if (migratedItr == shard.migratedData.end())
+            {
+                throw std::logic_error{"SharedPtrDataManagementTable::removeData called with non-managed data"};
+            }
+
+            if (--migratedItr->second.localCount > 0)
+            {
+                notifyLifecycleListener(&SharedPtrLifecycleListener::onRelease, voidData);
+                return false;
+            }
+
+            // the last local holder gives back the reference held on their behalf
+            //
+            auto* targetTable = migratedItr->second.targetTable;
+            shard.migratedData.erase(migratedItr);
+            shard.presenceFilter.erase(voidData);
+            return targetTable->removeData(voidData, deleteIfLast);
+        }
+
+        notifyLifecycleListener(&SharedPtrLifecycleListener::onRelease, voidData);
+
+        if (shard.managementTable.decrementCount(slot) > 0)
+        {
+            return false;
+        }
+
+        auto dataDeletion = takeDataDeletion(shard, voidData, shard.managementTable.getDeleterId(slot));
+        auto* creatorInboxNode = takeCreatorInboxNode(shard, slot);
+
+        shard.managementTable.eraseAt(slot);
+        shard.presenceFilter.erase(voidData);
+        setAdoptionOffset(shard, voidData, 0);
+
+        ++shard.stats.releasedCount;
+        --shard.stats.liveCount;
+
+        // the deleter may release other data of this table
+        //
+        unlockShard(lock);
+
+        if (deleteIfLast)
+        {
+            notifyLifecycleListener(&SharedPtrLifecycleListener::onDelete, voidData);
+
+            if (!creatorInboxNode || !CreatorInbox::Send(creatorInboxNode, dataDeletion))
+            {
+                deleteData(std::move(dataDeletion));
+            }
+        }
+        else if (creatorInboxNode)
+        {
+            CreatorInbox::Discard(creatorInboxNode);
+        }
+
+        return true;
+    }
+
+    template <typename DataT>
+    std::size_t getCount(DataT* data) const
+    {
+        return getKeyCount(resolveKey(convertToVoidPtr(data)));
+    }
+
+    // key must be resolveKey(convertToVoidPtr(data)), passed in by holders which already
+    // know it
+    //
+    std::size_t getKeyCount(void* voidData) const
+    {
+        auto& shard = getShard(voidData);
+        if (!mayBeInShard(shard, voidData))
+        {
+            return 0;
+        }
+
+        const auto lock = lockShard(shard);
+
+        const auto slot = shard.managementTable.find(voidData);
+        if (slot == SharedPtrPackedEntryTable::NotFound)
+        {
+            const auto migratedItr = shard.migratedData.find(voidData);
+            if (migratedItr == shard.migratedData.cend())
+            {
+                return 0;
+            }
+
+            return migratedItr->second.localCount + migratedItr->second.targetTable->getKeyCount(voidData) - 1;
+        }
+
+        return shard.managementTable.getCount(slot);
+    }
+
+    // moves the entry of data from this thread-local table into the domain adopting the raw
+    // data would pick, and returns the table the calling holder must use from now on. the
+    // local holders left behind are counted here and hold a single reference there together.
+    // key must be convertToVoidPtr(data)
+    //
+    template <typename DataT>
+    SharedPtrDataManagementTable& migrateData(DataT* data, void* key)
+    {
+        if (!isThreadLocal())
+        {
+            return *this;
+        }
+
+        RegisterFamilyType(data);
+
+        auto& shard = getShard(key);
+        const auto lock = lockShard(shard);
+
+        const auto slot = shard.managementTable.find(key);
+        if (slot != SharedPtrPackedEntryTable::NotFound)
+        {
+            auto& targetTable = GetSharedPtrDomainOf(data);
+
+            const auto localCount = shard.managementTable.getCount(slot) - 1;
+            const auto deleterId = shard.managementTable.getDeleterId(slot);
+            targetTable.insertMigratedData(key,
+                                           (localCount > 0) ? 2 : 1,
+                                           deleterId,
+                                           getAdoptedData(shard, key),
+                                           takeCustomDeleter(shard, key, deleterId));
+            setAdoptionOffset(shard, key, 0);
+
+            if (localCount > 0)
+            {
+                shard.migratedData.emplace(key, MigratedData{localCount, &targetTable});
+            }
+            else
+            {
+                shard.presenceFilter.erase(key);
+            }
+
+            shard.managementTable.eraseAt(slot);
+            --shard.stats.liveCount;
+
+            return targetTable;
+        }
+
+        const auto migratedItr = shard.migratedData.find(key);
+        if (migratedItr == shard.migratedData.end())
+        {
+            throw std::logic_error{"SharedPtrDataManagementTable::migrateData called with non-managed data"};
+        }
+
+        // when the last local holder leaves, it takes over the reference held on behalf
+        // of the local holders instead of adding its own
+        //
+        auto& targetTable = *migratedItr->second.targetTable;
+        if (--migratedItr->second.localCount > 0)
+        {
+            targetTable.insertMigratedData(key, 1, SharedPtrDeleterRegistry::NoDeleterId, key);
+        }
+        else
+        {
+            shard.migratedData.erase(migratedItr);
+            shard.presenceFilter.erase(key);
+        }
+
+        return targetTable;
+    }
+
+    // whether data is currently managed by this table, answered without probing the
+    // table for most of the data which is not
+    //
+    template <typename DataT>
+    bool isManaged(DataT* data) const
+    {
+        auto* voidData = resolveKey(convertToVoidPtr(data));
+        auto& shard = getShard(voidData);
+        if (!mayBeInShard(shard, voidData))
+        {
+            return false;
+        }
+
+        const auto lock = lockShard(shard);
+
+        if (shard.migratedData.count(voidData))
+        {
+            return true;
+        }
+
+        const auto slot = shard.managementTable.find(voidData);
+        return (slot != SharedPtrPackedEntryTable::NotFound) &&
+               (shard.managementTable.getDeleterId(slot) != SharedPtrDeleterRegistry::NoDeleterId);
+    }
+
+    // adds a holder only if data is already managed, as a single step
+    //
+    template <typename DataT>
+    bool addDataIfManaged(DataT* data)
+    {
+        auto* voidData = resolveKey(convertToVoidPtr(data));
+        auto& shard = getShard(voidData);
+        if (!mayBeInShard(shard, voidData))
+        {
+            return false;
+        }
+
+        const auto lock = lockShard(shard);
+
+        const auto migratedItr = shard.migratedData.find(voidData);
+        if (migratedItr != shard.migratedData.end())
+        {
+            ++migratedItr->second.localCount;
+            notifyLifecycleListener(&SharedPtrLifecycleListener::onCopy, voidData);
+            return true;
+        }
+
+        // data destroyed by destroyAllData() is not managed anymore, even if holders remain
+        //
+        const auto slot = shard.managementTable.find(voidData);
+        if ((slot == SharedPtrPackedEntryTable::NotFound) ||
+            (shard.managementTable.getDeleterId(slot) == SharedPtrDeleterRegistry::NoDeleterId))
+        {
+            return false;
+        }
+
+        shard.managementTable.incrementCount(slot, 1);
+        notifyLifecycleListener(&SharedPtrLifecycleListener::onCopy, voidData);
+        return true;
+    }
+
+    // makes the addresses in [begin, end) stand for key, so that adopting data lying in
+    // between finds the entry of key. MakeSharedPtrBulk does it for the elements of its
+    // blocks, and removes the range again before the block is deleted. adds nothing when
+    // it throws
+    //
+    void addAliasRange(const void* begin, const void* end, void* key)
+    {
+        auto* aliasShards = getAliasShards();
+        const auto beginAddress = reinterpret_cast<std::uintptr_t>(begin);
+        const auto endAddress = reinterpret_cast<std::uintptr_t>(end);
+
+        try
+        {
+            forEachAliasShard(aliasShards,
+                              beginAddress,
+                              endAddress,
+                              [beginAddress, endAddress, key](AliasShard& aliasShard)
+            {
+                const std::lock_guard<std::mutex> lock{aliasShard.mutex};
+
+                aliasShard.ranges[beginAddress] = AliasRange{endAddress, key};
+                aliasShard.count.store(aliasShard.ranges.size(), std::memory_order_release);
+            });
+        }
+        catch (...)
+        {
+            removeAliasRange(begin, end);
+            throw;
+        }
+    }
+
+    void removeAliasRange(const void* begin, const void* end)
+    {
+        const auto beginAddress = reinterpret_cast<std::uintptr_t>(begin);
+        forEachAliasShard(m_aliasShards.load(std::memory_order_acquire),
+                          beginAddress,
+                          reinterpret_cast<std::uintptr_t>(end),
+                          [beginAddress](AliasShard& aliasShard)
+        {
+            const std::lock_guard<std::mutex> lock{aliasShard.mutex};
+
+            aliasShard.ranges.erase(beginAddress);
+            aliasShard.count.store(aliasShard.ranges.size(), std::memory_order_release);
+        });
+    }
+
+    // the key of the entry managing data whose most derived object is at key, which is
+    // key itself unless it lies in an alias range. costs a load while the domain has none,
+    // and another one while the alias shard of the address has none
+    //
+    void* resolveKey(void* key) const
+    {
+        const auto* aliasShards = m_aliasShards.load(std::memory_order_acquire);
+        if (!aliasShards)
+        {
+            return key;
+        }
+
+        const auto address = reinterpret_cast<std::uintptr_t>(key);
+        auto& aliasShard = aliasShards[getAliasShardIndex(address >> AliasRegionBits)];
+        if (!aliasShard.count.load(std::memory_order_acquire))
+        {
+            return key;
+        }
+
+        const std::lock_guard<std::mutex> lock{aliasShard.mutex};
+
+        auto aliasItr = aliasShard.ranges.upper_bound(address);
+        if (aliasItr == aliasShard.ranges.cbegin())
+        {
+            return key;
+        }
+
+        --aliasItr;
+        return (address < aliasItr->second.end) ? aliasItr->second.key : key;
+    }
+
+    // deletes all the data of this domain at once. SharedPtrs still holding it are left
+    // dangling and may only be destroyed, released or assigned to; their entries stay
+    // behind without a deleter until then, so nothing gets deleted twice
+    //
+    std::size_t destroyAllData()
+    {
+        if (!m_policy.allowBulkDestruction)
+        {
+            throw std::logic_error{"SharedPtrDataManagementTable::destroyAllData called on domain " +
+                                   m_name + " which does not allow bulk destruction"};
+        }
+
+        // the deleters may release SharedPtrs of this same domain, so the table
+        // must neither be iterated nor locked while they run
+        //
+        std::vector<DataDeletion> dataToDestroy;
+        for (std::size_t shardIndex{0}; shardIndex < m_shardCount; ++shardIndex)
+        {
+            auto& shard = m_shards[shardIndex];
+            const auto lock = lockShard(shard);
+
+            const auto previousSize = dataToDestroy.size();
+            shard.managementTable.forEach([this, &shard, &dataToDestroy](void* data,
+                                                                        std::size_t,
+                                                                        DeleterId& deleterId)
+            {
+                if (deleterId != SharedPtrDeleterRegistry::NoDeleterId)
+                {
+                    notifyLifecycleListener(&SharedPtrLifecycleListener::onDelete, data);
+                    dataToDestroy.push_back(takeDataDeletion(shard, data, deleterId));
+                    if (auto* creatorInboxNode = takeCreatorInboxNode(shard, shard.managementTable.find(data)))
+                    {
+                        CreatorInbox::Discard(creatorInboxNode);
+                    }
+
+                    deleterId = SharedPtrDeleterRegistry::NoDeleterId;
+                }
+            });
+
+            shard.stats.bulkDestroyedCount += dataToDestroy.size() - previousSize;
+        }
+
+        for (auto& dataDeletion : dataToDestroy)
+        {
+            dataDeletion();
+        }
+
+        return dataToDestroy.size();
+    }
+
+    // calls callback(void* data, std::size_t count) for all the live data, with data being
+    // the address of the most derived object. every shard is copied under its lock and
+    // visited after unlocking it, so writers are only ever held up by one shard copy and
+    // the callback is free to use SharedPtrs of this table. the data may die in between,
+    // addDataIfManaged() keeps it alive while it is inspected. migrated data is visited
+    // by the domain it migrated to only, the one adopting the raw data would pick
+    //
+    template <typename CallbackT>
+    void forEachLive(CallbackT&& callback) const
+    {
+        std::vector<std::pair<void*, std::size_t>> shardSnapshot;
+        for (std::size_t shardIndex{0}; shardIndex < m_shardCount; ++shardIndex)
+        {
+            auto& shard = m_shards[shardIndex];
+
+            shardSnapshot.clear();
+            {
+                const auto lock = lockShard(shard);
+
+                shardSnapshot.reserve(shard.managementTable.size());
+                shard.managementTable.forEach([&shardSnapshot](void* data, std::size_t count, DeleterId& deleterId)
+                {
+                    if (deleterId != SharedPtrDeleterRegistry::NoDeleterId)
+                    {
+                        shardSnapshot.emplace_back(data, count);
+                    }
+                });
+            }
+
+            for (const auto& [data, count] : shardSnapshot)
+            {
+                callback(data, count);
+            }
+        }
+    }
+
+    // shrinks every shard down to what its live data needs, returning about how many
+    // bytes that released
+    //
+    std::size_t trim()
+    {
+        std::size_t releasedBytes{0};
+        for (std::size_t shardIndex{0}; shardIndex < m_shardCount; ++shardIndex)
+        {
+            auto& shard = m_shards[shardIndex];
+            const auto lock = lockShard(shard);
+
+            // the presence filter stays, as it is read without the lock
+            //
+            releasedBytes += shard.managementTable.shrinkToFit();
+
+            MigratedDataTable{shard.migratedData}.swap(shard.migratedData);
+            AdoptionOffsetTable{shard.adoptionOffsets}.swap(shard.adoptionOffsets);
+            CustomDeleterTable{shard.customDeleters}.swap(shard.customDeleters);
+        }
+
+        return releasedBytes;
+    }
+
+    const std::string& getName() const
+    {
+        return m_name;
+    }
+
+    const SharedPtrDomainPolicy& getPolicy() const
+    {
+        return m_policy;
+    }
+
+    SharedPtrDomainStats getStats() const
+    {
+        SharedPtrDomainStats stats{};
+        for (std::size_t shardIndex{0}; shardIndex < m_shardCount; ++shardIndex)
+        {
+            auto& shard = m_shards[shardIndex];
+            const auto lock = lockShard(shard);
+
+            stats.adoptedCount += shard.stats.adoptedCount;
+            stats.releasedCount += shard.stats.releasedCount;
+            stats.bulkDestroyedCount += shard.stats.bulkDestroyedCount;
+            stats.liveCount += shard.stats.liveCount;
+            stats.peakLiveCount += shard.stats.peakLiveCount;
+        }
+
+        return stats;
+    }
+
+    bool isThreadLocal() const
+    {
+        return m_ownerThread != std::thread::id{};
+    }
+
+    std::size_t getShardCount() const
+    {
+        return m_shardCount;
+    }
+
+private:
+    // only used by thread-local tables, counting the local holders of migrated data and
+    // remembering the table it migrated to
+    //
+    struct MigratedData
+    {
+        std::size_t localCount;
+        SharedPtrDataManagementTable* targetTable;
+    };
+
+    using MigratedDataTable = std::unordered_map<void*, MigratedData>;
+
+    // where the pointer the data was adopted through, and must be deleted through, lies
+    // relative to the most derived object; only recorded when they differ, which takes
+    // multiple inheritance
+    //
+    using AdoptionOffsetTable = std::unordered_map<void*, std::ptrdiff_t>;
+
+    // the deleters of the entries with SharedPtrDeleterRegistry::CustomDeleterId
+    //
+    using CustomDeleterTable = std::unordered_map<void*, CustomDeleter>;
+
+    // what deletes data once its entry is gone, run after unlocking
+    //
+    struct DataDeletion
+    {
+        void* data;
+        DeleterId deleterId;
+        CustomDeleter customDeleter;
+
+        void operator()()
+        {
+            if (customDeleter)
+            {
+                customDeleter(data);
+            }
+            else if (auto deleter = SharedPtrDeleterRegistry::Get(deleterId))
+            {
+                deleter(data);
+            }
+        }
+    };
+
+    // sorts the deletions by deleter and runs each group back to back, through its batch
+    // deleter when it has one, keeping the order they came in within each group. custom
+    // deleters are each their own group. the deleters may release more data, so the
+    // deletions are taken out of dataDeletions first
+    //
+    static void DeleteGrouped(std::vector<DataDeletion>& dataDeletions)
+    {
+        auto deletions = std::move(dataDeletions);
+        dataDeletions.clear();
+
+        std::vector<std::pair<DeleterId, void*>> groupedData;
+        groupedData.reserve(deletions.size());
+        for (auto& dataDeletion : deletions)
+        {
+            if (dataDeletion.customDeleter)
+            {
+                dataDeletion();
+            }
+            else if (dataDeletion.deleterId != SharedPtrDeleterRegistry::NoDeleterId)
+            {
+                groupedData.emplace_back(dataDeletion.deleterId, dataDeletion.data);
+            }
+        }
+
+        deletions = {};
+
+        std::stable_sort(groupedData.begin(), groupedData.end(), [](const auto& left, const auto& right)
+        {
+            return left.first < right.first;
+        });
+
+        std::vector<void*> groupData;
+        for (auto groupBegin = groupedData.begin(); groupBegin != groupedData.end();)
+        {
+            const auto deleterId = groupBegin->first;
+            const auto groupEnd = std::find_if(groupBegin, groupedData.end(), [deleterId](const auto& data)
+            {
+                return data.first != deleterId;
+            });
+
+            groupData.clear();
+            std::transform(groupBegin, groupEnd, std::back_inserter(groupData), [](const auto& data)
+            {
+                return data.second;
+            });
+
+            if (const auto batchDeleter = SharedPtrDeleterRegistry::GetBatch(deleterId))
+            {
+                batchDeleter(groupData.data(), groupData.size());
+            }
+            else
+            {
+                const auto deleter = SharedPtrDeleterRegistry::Get(deleterId);
+                for (auto* data : groupData)
+                {
+                    deleter(data);
+                }
+            }
+
+            groupBegin = groupEnd;
+        }
+    }
+
+    // the data this thread left for deletion in domains deferring it. there is none anymore
+    // for data released by the thread-local destructors running after this one
+    //
+    class DeferredDeletions
+    {
+    public:
+        static DeferredDeletions* GetForCurrentThread()
+        {
+            if (IsDestroyedForCurrentThread())
+            {
+                return nullptr;
+            }
+
+            thread_local DeferredDeletions deferredDeletions;
+            return &deferredDeletions;
+        }
+
+        DeferredDeletions(const DeferredDeletions&) = delete;
+        DeferredDeletions& operator=(const DeferredDeletions&) = delete;
+
+        ~DeferredDeletions()
+        {
+            flush();
+            IsDestroyedForCurrentThread() = true;
+        }
+
+        void push(DataDeletion&& dataDeletion)
+        {
+            m_dataDeletions.push_back(std::move(dataDeletion));
+            if (m_dataDeletions.size() >= SharedPtrConfig::Get().deferredDeletionBatchSize)
+            {
+                DeleteGrouped(m_dataDeletions);
+            }
+        }
+
+        // until the deleters stop releasing more data
+        //
+        std::size_t flush()
+        {
+            std::size_t deletedCount{0};
+            while (!m_dataDeletions.empty())
+            {
+                deletedCount += m_dataDeletions.size();
+                DeleteGrouped(m_dataDeletions);
+            }
+
+            return deletedCount;
+        }
+
+    private:
+        std::vector<DataDeletion> m_dataDeletions;
+
+        DeferredDeletions() = default;
+
+        static bool& IsDestroyedForCurrentThread()
+        {
+            thread_local bool isDestroyed{false};
+            return isDestroyed;
+        }
+    };
+
+    // where the data adopted by a thread gets sent back to by the other threads. the
+    // adopting thread takes a node from its own free list and the entry keeps it, so the
+    // thread which releases the data last only fills it in and pushes it, and nothing gets
+    // allocated or freed away from the creator thread. any thread pushes but only the owner
+    // takes, everything at once, so exchanging the head is all the synchronization needed.
+    // inboxes are never freed: the one of an exiting thread gets closed, which makes
+    // pushing to it fail so that the data is deleted on the spot, and is then reused by a
+    // new thread
+    //
+    class CreatorInbox
+    {
+    public:
+        struct Node
+        {
+            DataDeletion dataDeletion;
+            Node* next;
+            CreatorInbox* inbox;
+        };
+
+        static CreatorInbox* FindForCurrentThread()
+        {
+            return GetCurrentThreadInbox();
+        }
+
+        // a node for data the calling thread adopts, given back by Send() or Discard()
+        //
+        static Node* TakeNodeForCurrentThread()
+        {
+            auto& inbox = GetForCurrentThread();
+            auto* node = inbox.m_freeNodes;
+            if (!node)
+            {
+                return new Node{{}, nullptr, &inbox};
+            }
+
+            inbox.m_freeNodes = node->next;
+            return node;
+        }
+
+        // uses up node either way, but leaves dataDeletion to the caller when the inbox
+        // of node is closed or belongs to the calling thread
+        //
+        static bool Send(Node* node, DataDeletion& dataDeletion)
+        {
+            auto* inbox = node->inbox;
+            if (inbox->isOwnedByCurrentThread())
+            {
+                inbox->recycle(node);
+                return false;
+            }
+
+            node->dataDeletion = std::move(dataDeletion);
+            node->next = inbox->m_head.load(std::memory_order_relaxed);
+            do
+            {
+                if (node->next == GetClosedNode())
+                {
+                    dataDeletion = std::move(node->dataDeletion);
+                    delete node;
+                    return false;
+                }
+            }
+            while (!inbox->m_head.compare_exchange_weak(node->next,
+                                                        node,
+                                                        std::memory_order_release,
+                                                        std::memory_order_relaxed));
+
+            return true;
+        }
+
+        // gives back the node of data which does not get sent, freeing it only when the
+        // calling thread is not its creator
+        //
+        static void Discard(Node* node)
+        {
+            if (node->inbox->isOwnedByCurrentThread())
+            {
+                node->inbox->recycle(node);
+                return;
+            }
+
+            delete node;
+        }
+
+        std::size_t drain()
+        {
+            if (!m_head.load(std::memory_order_relaxed))
+            {
+                return 0;
+            }
+
+            return deleteAll(m_head.exchange(nullptr, std::memory_order_acquire), false);
+        }
+
+    private:
+        struct Owner
+        {
+            CreatorInbox* const inbox{takeFreeInbox()};
+
+            Owner()
+            {
+                GetCurrentThreadInbox() = inbox;
+            }
+
+            ~Owner()
+            {
+                GetCurrentThreadInbox() = nullptr;
+                inbox->deleteAll(inbox->m_head.exchange(GetClosedNode(), std::memory_order_acquire), true);
+
+                while (auto* node = inbox->m_freeNodes)
+                {
+                    inbox->m_freeNodes = node->next;
+                    delete node;
+                }
+
+                auto& freeInboxes = GetFreeInboxes();
+                const std::lock_guard<std::mutex> lock{freeInboxes.mutex};
+                freeInboxes.inboxes.push_back(inbox);
+            }
+
+            static CreatorInbox* takeFreeInbox()
+            {
+                auto& freeInboxes = GetFreeInboxes();
+                const std::lock_guard<std::mutex> lock{freeInboxes.mutex};
+
+                if (freeInboxes.inboxes.empty())
+                {
+                    return new CreatorInbox{};
+                }
+
+                auto* inbox = freeInboxes.inboxes.back();
+                freeInboxes.inboxes.pop_back();
+                inbox->m_head.store(nullptr, std::memory_order_relaxed);
+                return inbox;
+            }
+        };
+
+        struct FreeInboxes
+        {
+            std::mutex mutex;
+            std::vector<CreatorInbox*> inboxes;
+        };
+
+        std::atomic<Node*> m_head{nullptr};
+
+        // only ever touched by the owner thread
+        //
+        Node* m_freeNodes{nullptr};
+
+        static CreatorInbox& GetForCurrentThread()
+        {
+            thread_local const Owner owner{};
+            return *owner.inbox;
+        }
+
+        static CreatorInbox*& GetCurrentThreadInbox()
+        {
+            thread_local CreatorInbox* currentThreadInbox{nullptr};
+            return currentThreadInbox;
+        }
+
+        // never destroyed either, as threads may still exit after it would be
+        //
+        static FreeInboxes& GetFreeInboxes()
+        {
+            static auto* freeInboxes = new FreeInboxes{};
+            return *freeInboxes;
+        }
+
+        static Node* GetClosedNode()
+        {
+            static Node closedNode{};
+            return &closedNode;
+        }
+
+        bool isOwnedByCurrentThread() const
+        {
+            return this == GetCurrentThreadInbox();
+        }
+
+        void recycle(Node* node)
+        {
+            node->next = m_freeNodes;
+            m_freeNodes = node;
+        }
+
+        // the deleters may release data which gets pushed here again, to be deleted by
+        // the next drain. the nodes are free again before their deleters run, or freed
+        // when the inbox is closing
+        //
+        std::size_t deleteAll(Node* node, bool isClosing)
+        {
+            std::size_t deletedCount{0};
+            for (; node && node != GetClosedNode(); ++deletedCount)
+            {
+                auto* receivedNode = std::exchange(node, node->next);
+                auto dataDeletion = std::exchange(receivedNode->dataDeletion, DataDeletion{});
+                if (isClosing)
+                {
+                    delete receivedNode;
+                }
+                else
+                {
+                    recycle(receivedNode);
+                }
+
+                dataDeletion();
+            }
+
+            return deletedCount;
+        }
+    };
+
+    // the data is spread over independently locked shards by address, each one on its
+    // own cache lines
+    //
+    struct alignas(64) Shard
+    {
+        SharedPtrPackedEntryTable managementTable;
+        MigratedDataTable migratedData;
+
+        // covers the data of both tables above
+        //
+        SharedPtrPresenceFilter presenceFilter;
+
+        AdoptionOffsetTable adoptionOffsets;
+        CustomDeleterTable customDeleters;
+        SharedPtrDomainStats stats;
+        mutable std::mutex mutex;
+    };
+
+    const std::string m_name;
+    const SharedPtrDomainPolicy m_policy;
+    const std::thread::id m_ownerThread;
+    const std::size_t m_shardCount;
+    const std::unique_ptr<Shard[]> m_shards;
+
+    struct AliasRange
+    {
+        std::uintptr_t end;
+        void* key;
+    };
+
+    // the alias ranges are spread over independently locked shards by the regions of the
+    // address space they overlap, each range going into the shards of all its regions, so
+    // that looking up an address only locks the shard of its region, and only while that
+    // one has ranges. they get allocated by the first range of the domain
+    //
+    struct alignas(64) AliasShard
+    {
+        mutable std::mutex mutex;
+        std::map<std::uintptr_t, AliasRange> ranges;
+        std::atomic_size_t count{0};
+    };
+
+    static constexpr unsigned AliasRegionBits{20};
+    static constexpr std::size_t AliasShardCount{64};
+
+    std::mutex m_aliasMutex;
+    std::unique_ptr<AliasShard[]> m_aliasShardStorage;
+    std::atomic<AliasShard*> m_aliasShards{nullptr};
+
+    // what TrimAllDomains() walks
+    //
+    struct SharedTables
+    {
+        std::mutex mutex;
+        std::vector<SharedPtrDataManagementTable*> tables;
+    };
+
+    static SharedTables& GetSharedTables()
+    {
+        static SharedTables sharedTables;
+        return sharedTables;
+    }
+
+    // thread-local tables are never locked, so they gain nothing from sharding
+    //
+    SharedPtrDataManagementTable(std::string name,
+                                 const SharedPtrDomainPolicy& policy,
+                                 std::thread::id ownerThread = {})
+    : m_name{std::move(name)},
+      m_policy{policy},
+      m_ownerThread{ownerThread},
+      m_shardCount{isThreadLocal() ? 1 : roundUpToPowerOfTwo(m_policy.shardCount)},
+      m_shards{new Shard[m_shardCount]}
+    {
+        for (std::size_t shardIndex{0}; shardIndex < m_shardCount; ++shardIndex)
+        {
+            // the entries keep the inbox nodes of their creator threads
+            //
+            if (m_policy.returnToCreatorThread && !isThreadLocal())
+            {
+                m_shards[shardIndex].managementTable.enableAttachments();
+            }
+
+            m_shards[shardIndex].managementTable.reserve(m_policy.initialCapacity / m_shardCount);
+        }
+
+        if (!isThreadLocal())
+        {
+            auto& sharedTables = GetSharedTables();
+            const std::lock_guard<std::mutex> lock{sharedTables.mutex};
+
+            sharedTables.tables.push_back(this);
+        }
+    }
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t value)
+    {
+        std::size_t result{1};
+        while (result < value)
+        {
+            result *= 2;
+        }
+
+        return result;
+    }
+
+    Shard& getShard(const void* key) const
+    {
+        const auto keyHash = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(key) >> 4) *
+                             0x9E3779B97F4A7C15ull;
+        return m_shards[(keyHash >> 40) & (m_shardCount - 1)];
+    }
+
+    AliasShard* getAliasShards()
+    {
+        if (auto* aliasShards = m_aliasShards.load(std::memory_order_acquire))
+        {
+            return aliasShards;
+        }
+
+        const std::lock_guard<std::mutex> lock{m_aliasMutex};
+
+        if (!m_aliasShardStorage)
+        {
+            m_aliasShardStorage.reset(new AliasShard[AliasShardCount]);
+            m_aliasShards.store(m_aliasShardStorage.get(), std::memory_order_release);
+        }
+
+        return m_aliasShardStorage.get();
+    }
+
+    static std::size_t getAliasShardIndex(std::uintptr_t region)
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(region) * 0x9E3779B97F4A7C15ull) >> 58) &
+               (AliasShardCount - 1);
+    }
+
+    // calls callback(AliasShard&) once for each shard of the regions [begin, end) overlaps
+    //
+    template <typename CallbackT>
+    static void forEachAliasShard(AliasShard* aliasShards,
+                                  std::uintptr_t begin,
+                                  std::uintptr_t end,
+                                  CallbackT&& callback)
+    {
+        if (!aliasShards || (begin >= end))
+        {
+            return;
+        }
+
+        std::array<bool, AliasShardCount> isVisited{};
+        for (auto region = begin >> AliasRegionBits; region <= ((end - 1) >> AliasRegionBits); ++region)
+        {
+            const auto aliasShardIndex = getAliasShardIndex(region);
+            if (!std::exchange(isVisited[aliasShardIndex], true))
+            {
+                callback(aliasShards[aliasShardIndex]);
+            }
+        }
+    }
+
+    void onDataInserted(Shard& shard, void* data)
+    {
+        ++shard.stats.adoptedCount;
+        ++shard.stats.liveCount;
+        if (shard.stats.liveCount > shard.stats.peakLiveCount)
+        {
+            shard.stats.peakLiveCount = shard.stats.liveCount;
+        }
+
+        shard.presenceFilter.insert(data);
+        if (shard.managementTable.size() + shard.migratedData.size() > shard.presenceFilter.getCapacity())
+        {
+            rebuildPresenceFilter(shard, shard.presenceFilter.getBlockCount() * 2);
+        }
+    }
+
+    static void rebuildPresenceFilter(Shard& shard, std::size_t blockCount)
+    {
+        shard.presenceFilter.rebuild(blockCount, [&shard](const auto& insert)
+        {
+            shard.managementTable.forEach([&insert](void* data, std::size_t, DeleterId&)
+            {
+                insert(data);
+            });
+
+            for (const auto& [data, migratedData] : shard.migratedData)
+            {
+                insert(data);
+            }
+        });
+    }
+
+    // releases run in destructors, where the logic_error of lockShard() could only end in
+    // std::terminate, so a thread-local table released on another thread aborts with a
+    // message saying why instead
+    //
+    std::unique_lock<std::mutex> lockShardForRelease(const Shard& shard) const
+    {
+        if (isThreadLocal() && (m_ownerThread != std::this_thread::get_id()))
+        {
+            std::fputs("thread-local SharedPtrDataManagementTable released by another thread, "
+                       "SharedPtr::shareAcrossThreads() must be called first\n",
+                       stderr);
+            std::abort();
+        }
+
+        return lockShard(shard);
+    }
+
+    // asked before locking the shard, so that data which is definitely not managed costs
+    // no lock. thread-local tables still refuse other threads first
+    //
+    bool mayBeInShard(const Shard& shard, const void* key) const
+    {
+        if (isThreadLocal())
+        {
+            lockShard(shard);
+        }
+
+        return shard.presenceFilter.mayContain(key);
+    }
+
+    std::unique_lock<std::mutex> lockShard(const Shard& shard) const
+    {
+        if (!isThreadLocal())
+        {
+            return std::unique_lock<std::mutex>{shard.mutex};
+        }
+
+        if (m_ownerThread != std::this_thread::get_id())
+        {
+            throw std::logic_error{"thread-local SharedPtrDataManagementTable used by another thread, "
+                                   "SharedPtr::shareAcrossThreads() must be called first"};
+        }
+
+        return {};
+    }
+
+    void insertMigratedData(void* data,
+                            std::size_t count,
+                            DeleterId deleterId,
+                            void* adoptedData,
+                            CustomDeleter customDeleter = {})
+    {
+        auto& shard = getShard(data);
+        const auto lock = lockShard(shard);
+
+        const auto [slot, isInserted] = shard.managementTable.tryEmplace(data, count, deleterId);
+        if (isInserted)
+        {
+            setAdoptionOffset(shard, data, getAdoptionOffset(adoptedData, data));
+            setCustomDeleter(shard, data, deleterId, std::move(customDeleter));
+            onDataInserted(shard, data);
+            return;
+        }
+
+        shard.managementTable.incrementCount(slot, count);
+        if (shard.managementTable.getDeleterId(slot) == SharedPtrDeleterRegistry::NoDeleterId)
+        {
+            shard.managementTable.setDeleterId(slot, deleterId);
+            setAdoptionOffset(shard, data, getAdoptionOffset(adoptedData, data));
+            setCustomDeleter(shard, data, deleterId, std::move(customDeleter));
+        }
+    }
+
+    static void setCustomDeleter(Shard& shard, void* key, DeleterId deleterId, CustomDeleter customDeleter)
+    {
+        if (deleterId == SharedPtrDeleterRegistry::CustomDeleterId)
+        {
+            shard.customDeleters[key] = std::move(customDeleter);
+        }
+    }
+
+    static CustomDeleter takeCustomDeleter(Shard& shard, void* key, DeleterId deleterId)
+    {
+        if (deleterId != SharedPtrDeleterRegistry::CustomDeleterId)
+        {
+            return {};
+        }
+
+        const auto findItr = shard.customDeleters.find(key);
+        auto customDeleter = std::move(findItr->second);
+        shard.customDeleters.erase(findItr);
+
+        return customDeleter;
+    }
+
+    static DataDeletion takeDataDeletion(Shard& shard, void* key, DeleterId deleterId)
+    {
+        return DataDeletion{getAdoptedData(shard, key),
+                            deleterId,
+                            takeCustomDeleter(shard, key, deleterId)};
+    }
+
+    using LifecycleEvent = void (SharedPtrLifecycleListener::*)(const SharedPtrDataManagementTable&, const void*);
+
+    void notifyLifecycleListener([[maybe_unused]] LifecycleEvent event, [[maybe_unused]] const void* data) const
+    {
+#if defined(SHAREDPTR_LIFECYCLE_LISTENER)
+        if (auto* listener = SharedPtrLifecycleListener::GetInstalled())
+        {
+            (listener->*event)(*this, data);
+        }
+#endif
+    }
+
+    // thread-local data never changes threads before its entry leaves the table, and only
+    // data deleted by its own delete has a batch deleter and may wait to be deleted
+    //
+    void setCreatorInboxNode(Shard& shard, std::size_t slot) const
+    {
+        if (m_policy.returnToCreatorThread && !isThreadLocal() && !shard.managementTable.getAttachment(slot) &&
+            SharedPtrDeleterRegistry::GetBatch(shard.managementTable.getDeleterId(slot)))
+        {
+            shard.managementTable.setAttachment(slot, CreatorInbox::TakeNodeForCurrentThread());
+        }
+    }
+
+    static CreatorInbox::Node* takeCreatorInboxNode(Shard& shard, std::size_t slot)
+    {
+        auto* creatorInboxNode = static_cast<CreatorInbox::Node*>(shard.managementTable.getAttachment(slot));
+        if (creatorInboxNode)
+        {
+            shard.managementTable.setAttachment(slot, nullptr);
+        }
+
+        return creatorInboxNode;
+    }
+
+    // entries left behind by destroyAllData() have nothing to delete anymore, and neither
+    // they nor data with a deleter of its own have a batch deleter
+    //
+    void deleteData(DataDeletion&& dataDeletion) const
+    {
+        if (m_policy.deferDeletion && SharedPtrDeleterRegistry::GetBatch(dataDeletion.deleterId))
+        {
+            if (auto* deferredDeletions = DeferredDeletions::GetForCurrentThread())
+            {
+                deferredDeletions->push(std::move(dataDeletion));
+                return;
+            }
+        }
+
+        dataDeletion();
+    }
+
+    // runs before locking, as the deleters may release data of this same table
+    //
+    void drainCreatorInbox() const
+    {
+        if (m_policy.returnToCreatorThread)
+        {
+            DrainCreatorInbox();
+        }
+    }
+
+    using FamilyTypeTable = std::unordered_map<std::type_index, FamilyType>;
+
+    // every published snapshot is kept, as readers may still look into any of them, which
+    // takes one per type that ever got known
+    //
+    struct FamilyTypes
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<const FamilyTypeTable>> snapshots;
+        std::atomic<const FamilyTypeTable*> published{nullptr};
+    };
+
+    // never destroyed, as data may still be adopted while static storage goes away
+    //
+    static FamilyTypes& GetFamilyTypes()
+    {
+        static auto* familyTypes = new FamilyTypes{};
+        return *familyTypes;
+    }
+
+    // merges what familyType tells into what is known about mostDerivedType, publishing a
+    // new snapshot if that changes anything
+    //
+    static void PublishFamilyType(const std::type_info& mostDerivedType, const FamilyType& familyType)
+    {
+        auto& familyTypes = GetFamilyTypes();
+        const std::lock_guard<std::mutex> lock{familyTypes.mutex};
+
+        const auto* previousTable = familyTypes.published.load(std::memory_order_relaxed);
+        auto familyTypeTable = previousTable ? std::make_unique<FamilyTypeTable>(*previousTable) :
+                                               std::make_unique<FamilyTypeTable>();
+
+        const auto [familyTypeItr, isInserted] = familyTypeTable->emplace(mostDerivedType, familyType);
+        if (!isInserted)
+        {
+            auto& knownFamilyType = familyTypeItr->second;
+            if ((knownFamilyType.table || !familyType.table) &&
+                (knownFamilyType.wasAdoptedOutsideFamily || !familyType.wasAdoptedOutsideFamily))
+            {
+                return;
+            }
+
+            knownFamilyType.table = knownFamilyType.table ? knownFamilyType.table : familyType.table;
+            knownFamilyType.wasAdoptedOutsideFamily |= familyType.wasAdoptedOutsideFamily;
+        }
+
+        familyTypes.snapshots.push_back(std::move(familyTypeTable));
+        familyTypes.published.store(familyTypes.snapshots.back().get(), std::memory_order_release);
+    }
+
+    static void unlockShard(std::unique_lock<std::mutex>& lock)
+    {
+        if (lock.owns_lock())
+        {
+            lock.unlock();
+        }
+    }
+
+    template <typename DataT>
+    static std::ptrdiff_t getAdoptionOffset(DataT* data, void* key)
+    {
+        auto* adoptedData = static_cast<const void*>(data);
+        return reinterpret_cast<std::intptr_t>(adoptedData) - reinterpret_cast<std::intptr_t>(key);
+    }
+
+    static void setAdoptionOffset(Shard& shard, void* key, std::ptrdiff_t adoptionOffset)
+    {
+        if (adoptionOffset)
+        {
+            shard.adoptionOffsets[key] = adoptionOffset;
+        }
+        else if (!shard.adoptionOffsets.empty())
+        {
+            shard.adoptionOffsets.erase(key);
+        }
+    }
+
+    static void* getAdoptedData(const Shard& shard, void* key)
+    {
+        if (shard.adoptionOffsets.empty())
+        {
+            return key;
+        }
+
+        const auto findItr = shard.adoptionOffsets.find(key);
+        if (findItr == shard.adoptionOffsets.cend())
+        {
+            return key;
+        }
+
+        return reinterpret_cast<void*>(reinterpret_cast<std::intptr_t>(key) + findItr->second);
+    }
+};
+
+
+// gives memory back when the system runs short of it: Trim() first tells the registered
+// listeners, typically caches which drop the SharedPtrs they can recreate, then shrinks
+// every shared table and lets the allocator return its free memory to the OS. the monitor
+// does that from a background thread whenever the memory PSI (/proc/pressure/memory)
+// crosses the configured threshold or the cgroup reports its memory.high limit was hit,
+// and keeps doing so on every poll for as long as the pressure lasts
+//
+class SharedPtrMemoryPressure
+{
+public:
+    using Listener = std::function<void()>;
+    using ListenerId = std::size_t;
+
+    static ListenerId AddListener(Listener listener)
+    {
+        auto& state = GetState();
+        const std::lock_guard<std::mutex> lock{state.mutex};
+
+        const auto listenerId = state.nextListenerId++;
+        state.listeners.emplace(listenerId, std::make_shared<Listener>(std::move(listener)));
+        return listenerId;
+    }
+
+    static void RemoveListener(ListenerId listenerId)
+    {
+        auto& state = GetState();
+        const std::lock_guard<std::mutex> lock{state.mutex};
+
+        state.listeners.erase(listenerId);
+    }
+
+    // returns about how many bytes the tables released
+    //
+    static std::size_t Trim()
+    {
+        std::vector<std::shared_ptr<Listener>> listeners;
+        {
+            auto& state = GetState();
+            const std::lock_guard<std::mutex> lock{state.mutex};
+
+            for (const auto& [listenerId, listener] : state.listeners)
+            {
+                listeners.push_back(listener);
+            }
+        }
+
+        // the listeners are free to release SharedPtrs and to add or remove listeners
+        //
+        for (const auto& listener : listeners)
+        {
+            (*listener)();
+        }
+
+        const auto releasedBytes = SharedPtrDataManagementTable::TrimAllDomains();
+
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+
+        return releasedBytes;
+    }
+
+    static void StartMonitor(std::size_t thresholdPercent = SharedPtrConfig::Get().pressureThresholdPercent,
+                             std::chrono::milliseconds pollInterval = std::chrono::milliseconds{
+                                 SharedPtrConfig::Get().pressurePollIntervalMs})
+    {
+        auto& state = GetState();
+        const std::lock_guard<std::mutex> lock{state.mutex};
+
+        if (state.monitorThread.joinable())
+        {
+            throw std::logic_error{"SharedPtrMemoryPressure::StartMonitor called while the monitor is running"};
+        }
+
+        state.isMonitorStopping = false;
+        state.monitorThread = std::thread{[thresholdPercent, pollInterval]()
+        {
+            MonitorPressure(thresholdPercent, pollInterval);
+        }};
+    }
+
+    static void StopMonitor()
+    {
+        auto& state = GetState();
+        std::thread monitorThread;
+        {
+            const std::lock_guard<std::mutex> lock{state.mutex};
+
+            state.isMonitorStopping = true;
+            monitorThread = std::move(state.monitorThread);
+        }
+
+        state.monitorCondition.notify_all();
+        if (monitorThread.joinable())
+        {
+            monitorThread.join();
+        }
+    }
+
+    // the share of the last 10 seconds in which some task was stalled on memory, as a
+    // percentage, or a negative value where the kernel does not report it
+    //
+    static double GetMemoryPressure()
+    {
+        std::ifstream pressureFile{"/proc/pressure/memory"};
+
+        std::string field;
+        while (pressureFile >> field)
+        {
+            if ((field == "some") && (pressureFile >> field) && (field.compare(0, 6, "avg10=") == 0))
+            {
+                return std::strtod(field.c_str() + 6, nullptr);
+            }
+        }
+
+        return -1.0;
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::map<ListenerId, std::shared_ptr<Listener>> listeners;
+        ListenerId nextListenerId{1};
+
+        std::condition_variable monitorCondition;
+        std::thread monitorThread;
+        bool isMonitorStopping{false};
+
+        ~State()
+        {
+            StopMonitor();
+        }
+    };
+
+    static State& GetState()
+    {
+        static State state;
+        return state;
+    }
+
+    // how many times the cgroup of this process went over its memory.high limit, or 0 where
+    // there is no cgroup v2 to tell
+    //
+    static std::size_t GetMemoryHighEventCount()
+    {
+        std::ifstream eventsFile{"/sys/fs/cgroup/memory.events"};
+
+        std::string field;
+        std::size_t eventCount{0};
+        while (eventsFile >> field >> eventCount)
+        {
+            if (field == "high")
+            {
+                return eventCount;
+            }
+        }
+
+        return 0;
+    }
+
+    static void MonitorPressure(std::size_t thresholdPercent, std::chrono::milliseconds pollInterval)
+    {
+        auto& state = GetState();
+        auto memoryHighEventCount = GetMemoryHighEventCount();
+
+        std::unique_lock<std::mutex> lock{state.mutex};
+        while (!state.monitorCondition.wait_for(lock, pollInterval, [&state]()
+               {
+                   return state.isMonitorStopping;
+               }))
+        {
+            lock.unlock();
+
+            const auto previousMemoryHighEventCount = std::exchange(memoryHighEventCount,
+                                                                    GetMemoryHighEventCount());
+            if ((GetMemoryPressure() >= static_cast<double>(thresholdPercent)) ||
+                (memoryHighEventCount > previousMemoryHighEventCount))
+            {
+                Trim();
+            }
+
+            lock.lock();
+        }
+    }
+};
+
+
+// selects the domain in which SharedPtr<DataT> adopts raw data: the family table when
+// DataT belongs to one, the default domain otherwise. specialize it to move a type
+// elsewhere
+//
+template <typename DataT>
+struct SharedPtrDomainOf
+{
+    static SharedPtrDataManagementTable& Get()
+    {
+        using FamilyRoot = typename SharedPtrFamilyRootOf<DataT>::Type;
+
+        if constexpr (std::is_void_v<FamilyRoot>)
+        {
+            return SharedPtrDataManagementTable::GetInstance();
+        }
+        else
+        {
+            return SharedPtrDataManagementTable::GetFamilyInstance<FamilyRoot>();
+        }
+    }
+};
+
+
+// the domain in which data gets adopted through a raw DataT pointer. that is the one of
+// SharedPtrDomainOf, except for data whose most derived type belongs to a family: it goes
+// to the family table even when DataT is a base from outside of the family. data adopted
+// that way in the default domain before its type was known to belong there stays in it,
+// which only the types this happened to keep checking for
+//
+template <typename DataT>
+SharedPtrDataManagementTable& GetSharedPtrDomainOf(DataT* data)
+{
+    auto& domain = SharedPtrDomainOf<DataT>::Get();
+
+    if constexpr (std::is_polymorphic_v<DataT>)
+    {
+        using FamilyRoot = typename SharedPtrFamilyRootOf<DataT>::Type;
+        auto& defaultDomain = SharedPtrDataManagementTable::GetInstance();
+
+        if (!data)
+        {
+            return domain;
+        }
+
+        SharedPtrDataManagementTable* familyDomain{nullptr};
+        const auto* familyType = SharedPtrDataManagementTable::FindFamilyType(typeid(*data));
+        if constexpr (std::is_void_v<FamilyRoot>)
+        {
+            if (&domain == &defaultDomain)
+            {
+                if (!familyType || !familyType->table)
+                {
+                    SharedPtrDataManagementTable::RegisterAdoptionOutsideFamily(typeid(*data));
+                    return domain;
+                }
+
+                familyDomain = familyType->table;
+            }
+        }
+        else
+        {
+            if (&domain == &SharedPtrDataManagementTable::GetFamilyInstance<FamilyRoot>())
+            {
+                familyDomain = &domain;
+            }
+        }
+
+        if (familyDomain)
+        {
+            return (familyType && familyType->wasAdoptedOutsideFamily && defaultDomain.isManaged(data)) ?
+                   defaultDomain : *familyDomain;
+        }
+    }
+
+    return domain;
+}
+
+
+// intrusive list node embedded into every SharedPtr when SHAREDPTR_TRACK_HOLDERS is
+// defined, linking all the holders of the same data
+//
+struct SharedPtrHolderNode
+{
+    SharedPtrHolderNode* previous{nullptr};
+    SharedPtrHolderNode* next{nullptr};
+    const void* holder{nullptr};
+    const void* creationSite{nullptr};
+    std::thread::id thread{};
+    bool isRegistered{false};
+};
+
+
+struct SharedPtrHolderInfo
+{
+    const void* holder;
+    const void* creationSite;
+    std::thread::id thread;
+};
+
+
+// knows which SharedPtr instances hold which data, in builds defining SHAREDPTR_TRACK_HOLDERS,
+// so that whatever keeps an object alive can be dumped. only one in getSamplingRate() of the
+// objects is tracked, chosen by address, so that it stays affordable on canaries. creation
+// sites are return addresses, to be symbolized offline
+//
+class SharedPtrHolderRegistry
+{
+public:
+    static auto& GetInstance()
+    {
+        static SharedPtrHolderRegistry instance{};
+        return instance;
+    }
+
+    SharedPtrHolderRegistry(const SharedPtrHolderRegistry&) = delete;
+    SharedPtrHolderRegistry& operator=(const SharedPtrHolderRegistry&) = delete;
+    SharedPtrHolderRegistry(SharedPtrHolderRegistry&&) = delete;
+    SharedPtrHolderRegistry& operator=(SharedPtrHolderRegistry&&) = delete;
+
+    // zero stops tracking new holders
+    //
+    void setSamplingRate(std::size_t samplingRate)
+    {
+        m_samplingRate.store(samplingRate, std::memory_order_relaxed);
+    }
+
+    std::size_t getSamplingRate() const
+    {
+        return m_samplingRate.load(std::memory_order_relaxed);
+    }
+
+    // best effort, as SharedPtrs register in their noexcept moves too: a holder the
+    // registry has no memory left for goes untracked
+    //
+    void registerHolder(const void* key,
+                        SharedPtrHolderNode& node,
+                        const void* holder,
+                        const void* creationSite) noexcept
+    {
+        const auto samplingRate = getSamplingRate();
+        if (!samplingRate || ((reinterpret_cast<std::uintptr_t>(key) >> 4) % samplingRate))
+        {
+            return;
+        }
+
+        node.holder = holder;
+        node.creationSite = creationSite;
+        node.thread = std::this_thread::get_id();
+
+        try
+        {
+            const std::lock_guard<std::mutex> lock{m_mutex};
+
+            auto& head = m_heads[key];
+            node.previous = nullptr;
+            node.next = head;
+            if (head)
+            {
+                head->previous = &node;
+            }
+
+            head = &node;
+            node.isRegistered = true;
+        }
+        catch (...)
+        {
+            node.isRegistered = false;
+        }
+    }
+
+    void unregisterHolder(const void* key, SharedPtrHolderNode& node)
+    {
+        if (!node.isRegistered)
+        {
+            return;
+        }
+
+        const std::lock_guard<std::mutex> lock{m_mutex};
+
+        if (node.next)
+        {
+            node.next->previous = node.previous;
+        }
+
+        if (node.previous)
+        {
+            node.previous->next = node.next;
+        }
+        else if (node.next)
+        {
+            m_heads[key] = node.next;
+        }
+        else
+        {
+            m_heads.erase(key);
+        }
+
+        node = SharedPtrHolderNode{};
+    }
+
+    template <typename DataT>
+    std::vector<SharedPtrHolderInfo> getHolders(DataT* data) const
+    {
+        auto* key = convertToVoidPtr(data);
+        std::vector<SharedPtrHolderInfo> holders;
+
+        const std::lock_guard<std::mutex> lock{m_mutex};
+
+        const auto findItr = m_heads.find(key);
+        if (findItr == m_heads.cend())
+        {
+            return holders;
+        }
+
+        for (auto* node = findItr->second; node; node = node->next)
+        {
+            holders.push_back(SharedPtrHolderInfo{node->holder, node->creationSite, node->thread});
+        }
+
+        return holders;
+    }
+
+    template <typename DataT>
+    void dumpHolders(DataT* data, std::ostream& outputStream) const
+    {
+        const auto holders = getHolders(data);
+
+        outputStream << "SharedPtr holders of " << static_cast<const void*>(convertToVoidPtr(data))
+                     << ": " << holders.size() << "\n";
+        for (const auto& holder : holders)
+        {
+            outputStream << "    holder " << holder.holder << " created at " << holder.creationSite
+                         << " on thread " << holder.thread << "\n";
+        }
+
+        outputStream << std::flush;
+    }
+
+private:
+    std::atomic_size_t m_samplingRate{SharedPtrConfig::Get().holderSamplingRate};
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<const void*, SharedPtrHolderNode*> m_heads;
+
+    SharedPtrHolderRegistry() = default;
+};
+
+
+template <typename DataT>
+class SharedPtr
+{
+public:
+    using Data = DataT;
+
+    explicit SharedPtr(DataT* data)
+    : SharedPtr{data, &GetSharedPtrDomainOf(data)}
+    {
+
+    }
+
+    SharedPtr(DataT* data, SharedPtrDataManagementTable& managementTable)
+    : SharedPtr{data, &managementTable}
+    {
+
+    }
+
+    // data gets deleted by calling deleter with it instead of with delete. stateless
+    // deleters cost nothing besides a registry id, the others are kept by the table
+    //
+    template <typename DeleterT, typename = std::enable_if_t<std::is_invocable_v<DeleterT&, DataT*>>>
+    SharedPtr(DataT* data,
+              DeleterT deleter,
+              SharedPtrDataManagementTable& managementTable = SharedPtrDomainOf<DataT>::Get())
+    : m_data{data},
+      m_key{getAdoptionKey(data, &managementTable)},
+      m_managementTable{&managementTable}
+    {
+        if (!m_data)
+        {
+            return;
+        }
+
+        if constexpr (IsStatelessDeleter<DeleterT>)
+        {
+            m_managementTable->addDataWithDeleter(m_key,
+                                                  const_cast<std::remove_cv_t<DataT>*>(m_data),
+                                                  SharedPtrDeleterRegistry::GetFunctionId<&deleteDataWith<DataT, DeleterT>>());
+        }
+        else
+        {
+            m_managementTable->addDataWithDeleter(m_key,
+                                                  const_cast<std::remove_cv_t<DataT>*>(m_data),
+                                                  SharedPtrDeleterRegistry::CustomDeleterId,
+                                                  [deleter = std::move(deleter)](void* data) mutable
+                                                  {
+                                                      deleter(static_cast<DataT*>(data));
+                                                  });
+        }
+
+        trackHolder(getCreationSite());
+    }
+
+    // unlike the adopting constructors, returns a null SharedPtr for data that is not
+    // managed yet
+    //
+    static SharedPtr<DataT> TryAdopt(DataT* data)
+    {
+        return TryAdopt(data, GetSharedPtrDomainOf(data));
+    }
+
+    static SharedPtr<DataT> TryAdopt(DataT* data, SharedPtrDataManagementTable& managementTable)
+    {
+        SharedPtr<DataT> sharedPtr{};
+        if (!data)
+        {
+            return sharedPtr;
+        }
+
+        auto* key = managementTable.resolveKey(convertToVoidPtr(data));
+        if (managementTable.addDataIfManaged(key))
+        {
+            sharedPtr.m_data = data;
+            sharedPtr.m_key = key;
+            sharedPtr.m_managementTable = &managementTable;
+            sharedPtr.trackHolder(getCreationSite());
+        }
+
+        return sharedPtr;
+    }
+
+    SharedPtr()
+    : SharedPtr{static_cast<DataT*>(nullptr), static_cast<SharedPtrDataManagementTable*>(nullptr)}
+    {
+
+    }
+
+    explicit SharedPtr(std::nullptr_t)
+    : SharedPtr{}
+    {
+
+    }
+
+    SharedPtr(const SharedPtr<DataT>& other)
+    : SharedPtr{other.m_data, other.m_key, other.m_managementTable}
+    {
+
+    }
+
+    SharedPtr(SharedPtr<DataT>&& other) noexcept
+    : m_data{other.m_data},
+      m_key{other.m_key},
+      m_managementTable{other.m_managementTable}
+    {
+        other.untrackHolder();
+        other.m_data = nullptr;
+        trackHolder(getCreationSite());
+    }
+
+    template <typename DataU, typename = std::enable_if_t<std::is_base_of_v<DataT, DataU> ||
+                                                          std::is_base_of_v<DataU, DataT>>>
+    SharedPtr(DataU* data)
+    : SharedPtr{castData(data)}
+    {
+
+    }
+
+    template <typename DataU>
+    SharedPtr(const SharedPtr<DataU>& other)
+    : SharedPtr{castData(other.m_data), other.m_key, other.m_managementTable}
+    {
+
+    }
+
+    template <typename DataU, typename = std::enable_if_t<std::is_base_of_v<DataT, DataU>>>
+    SharedPtr(SharedPtr<DataU>&& other) noexcept
+    : m_data{other.m_data},
+      m_key{other.m_key},
+      m_managementTable{other.m_managementTable}
+    {
+        other.untrackHolder();
+        other.m_data = nullptr;
+        trackHolder(getCreationSite());
+    }
+
+    SharedPtr<DataT>& operator=(const SharedPtr<DataT>& other)
+    {
+        assignSelf(other);
+        return *this;
+    }
+
+    SharedPtr<DataT>& operator=(SharedPtr<DataT>&& other) noexcept
+    {
+        assignSelf(std::move(other));
+        return *this;
+    }
+
+    template <typename DataU>
+    SharedPtr<DataT>& operator=(const SharedPtr<DataU>& other)
+    {
+        assignSelf(other);
+        return *this;
+    }
+
+    template <typename DataU>
+    SharedPtr<DataT>& operator=(SharedPtr<DataU>&& other) noexcept
+    {
+        assignSelf(std::move(other));
+        return *this;
+    }
+
+    ~SharedPtr()
+    {
+        releaseData(true);
+    }
+
+    void release()
+    {
+        releaseData(false);
+    }
+
+    // must be called on the creating thread before this SharedPtr, or any copy made
+    // from it afterwards, reaches another thread when its data lives in a thread-local
+    // table. does nothing for data in any other table
+    //
+    void shareAcrossThreads()
+    {
+        if (m_data)
+        {
+            m_managementTable = &m_managementTable->migrateData(m_data, m_key);
+        }
+    }
+
+    DataT* operator->()
+    {
+        throwIfInvalidAccess();
+
+        return m_data;
+    }
+
+    const DataT* operator->() const
+    {
+        throwIfInvalidAccess();
+
+        return m_data;
+    }
+
+    DataT& operator*()
+    {
+        throwIfInvalidAccess();
+
+        return *m_data;
+    }
+
+    const DataT& operator*() const
+    {
+        throwIfInvalidAccess();
+
+        return *m_data;
+    }
+
+    operator bool() const
+    {
+        return m_data;
+    }
+
+    std::size_t getUseCount() const
+    {
+        if (!m_data)
+        {
+            return 0;
+        }
+
+        return m_managementTable->getKeyCount(m_key);
+    }
+
+    template<typename> friend class SharedPtr;
+    template<typename> friend class NotNullSharedPtr;
+
+private:
+    DataT* m_data;
+
+    // the table key of m_data, resolved once on adoption and then handed down to every
+    // copy, so that only adopting a raw pointer pays for finding the most derived object
+    //
+    void* m_key;
+
+    SharedPtrDataManagementTable* m_managementTable;
+
+#if defined(SHAREDPTR_TRACK_HOLDERS)
+    SharedPtrHolderNode m_holderNode;
+#endif
+
+    SharedPtr(DataT* data, SharedPtrDataManagementTable* managementTable)
+    : SharedPtr{data, getAdoptionKey(data, managementTable), managementTable}
+    {
+
+    }
+
+    // the most derived type of adopted data gets known before its entry exists
+    //
+    static void* getAdoptionKey(DataT* data, SharedPtrDataManagementTable* managementTable)
+    {
+        if (!data)
+        {
+            return nullptr;
+        }
+
+        SharedPtrDataManagementTable::RegisterFamilyType(data);
+        return managementTable->resolveKey(convertToVoidPtr(data));
+    }
+
+    SharedPtr(DataT* data, void* key, SharedPtrDataManagementTable* managementTable)
+    : m_data{data},
+      m_key{key},
+      m_managementTable{managementTable}
+    {
+        if (m_data)
+        {
+            m_managementTable->addData(m_data, m_key);
+            trackHolder(getCreationSite());
+        }
+    }
+
+    template <typename DataU>
+    static DataT* castData(DataU* data)
+    {
+        if constexpr (std::is_base_of_v<DataT, DataU>)
+        {
+            return static_cast<DataT*>(data);
+        }
+        else
+        {
+            return dynamic_cast<DataT*>(data);
+        }
+    }
+
+    template <typename SharedPtrT>
+    void assignSelf(SharedPtrT&& other)
+    {
+        using DataU = typename std::remove_reference_t<std::remove_cv_t<SharedPtrT>>::Data;
+
+        static_assert(std::is_same_v<DataT, DataU> || std::is_base_of_v<DataT, DataU>,
+                      "SharedPtr may only be assigned to SharedPtr<derived from this one's DataT>");
+
+        if constexpr (std::is_same_v<DataT, DataU>)
+        {
+            if (this == &other)
+            {
+                return;
+            }
+        }
+
+        releaseData(true);
+
+        m_data = other.m_data;
+        m_key = other.m_key;
+        m_managementTable = other.m_managementTable;
+        assignSelfContinuation(std::forward<SharedPtrT>(other));
+    }
+
+    template <typename DataU>
+    void assignSelfContinuation(const SharedPtr<DataU>&)
+    {
+        if (m_data)
+        {
+            m_managementTable->addData(m_data, m_key);
+            trackHolder(getCreationSite());
+        }
+    }
+
+    template <typename DataU>
+    void assignSelfContinuation(SharedPtr<DataU>&& other)
+    {
+        other.untrackHolder();
+        other.m_data = nullptr;
+        trackHolder(getCreationSite());
+    }
+
+    void releaseData(bool deleteIfLast)
+    {
+        if (m_data)
+        {
+            untrackHolder();
+            m_managementTable->removeData(m_key, deleteIfLast);
+        }
+
+        m_data = nullptr;
+    }
+
+    // always inlined so that the return address is the one of the SharedPtr member calling it
+    //
+#if defined(__GNUC__)
+    [[gnu::always_inline]]
+#endif
+    static inline const void* getCreationSite()
+    {
+#if defined(SHAREDPTR_TRACK_HOLDERS) && defined(__GNUC__)
+        return __builtin_extract_return_addr(__builtin_return_address(0));
+#else
+        return nullptr;
+#endif
+    }
+
+    void trackHolder([[maybe_unused]] const void* creationSite)
+    {
+#if defined(SHAREDPTR_TRACK_HOLDERS)
+        if (m_data)
+        {
+            SharedPtrHolderRegistry::GetInstance().registerHolder(m_key, m_holderNode, this, creationSite);
+        }
+#endif
+    }
+
+    void untrackHolder()
+    {
+#if defined(SHAREDPTR_TRACK_HOLDERS)
+        SharedPtrHolderRegistry::GetInstance().unregisterHolder(m_key, m_holderNode);
+#endif
+    }
+
+    void throwIfInvalidAccess() const
+    {
+        if (!m_data)
+        {
+            throw std::logic_error{"SharedPtr dereferenced with null managed data"};
+        }
+    }
+};
+
+
+template <typename DataT>
+bool IsSharedPtrManaged(DataT* data)
+{
+    return data && GetSharedPtrDomainOf(data).isManaged(data);
+}
+
+
+template <typename DataT>
+class NotNullSharedPtr;
+
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtr(ArgsT&&... args);
+
+template <typename DataT>
+NotNullSharedPtr<DataT> AsNotNullSharedPtr(SharedPtr<DataT> sharedPtr);
+
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrInDomain(SharedPtrDataManagementTable& domain, ArgsT&&... args);
+
+template <typename DataT, typename InitT>
+std::vector<NotNullSharedPtr<DataT>> MakeSharedPtrBulk(std::size_t elementCount, InitT&& init);
+
+
+// a SharedPtr that is never null, so dereferencing it is a plain load without
+// the throwIfInvalidAccess() check. it can only be obtained from MakeSharedPtr()
+// or from the checked AsNotNullSharedPtr() conversion. moving it into another
+// NotNullSharedPtr copies instead, so the only way to empty one is converting it
+// to a SharedPtr as an rvalue; like any moved-from object it may then only be
+// destroyed or assigned to
+//
+template <typename DataT>
+class NotNullSharedPtr
+{
+public:
+    using Data = DataT;
+
+    NotNullSharedPtr(const NotNullSharedPtr<DataT>& other) = default;
+    NotNullSharedPtr<DataT>& operator=(const NotNullSharedPtr<DataT>& other) = default;
+
+    template <typename DataU, typename = std::enable_if_t<std::is_base_of_v<DataT, DataU>>>
+    NotNullSharedPtr(const NotNullSharedPtr<DataU>& other)
+    : m_sharedPtr{other.m_sharedPtr}
+    {
+
+    }
+
+    DataT* operator->()
+    {
+        assert(m_sharedPtr.m_data);
+
+        return m_sharedPtr.m_data;
+    }
+
+    const DataT* operator->() const
+    {
+        assert(m_sharedPtr.m_data);
+
+        return m_sharedPtr.m_data;
+    }
+
+    DataT& operator*()
+    {
+        assert(m_sharedPtr.m_data);
+
+        return *m_sharedPtr.m_data;
+    }
+
+    const DataT& operator*() const
+    {
+        assert(m_sharedPtr.m_data);
+
+        return *m_sharedPtr.m_data;
+    }
+
+    template <typename DataU, typename = std::enable_if_t<std::is_same_v<DataU, DataT> ||
+                                                          std::is_base_of_v<DataU, DataT>>>
+    operator SharedPtr<DataU>() const &
+    {
+        return SharedPtr<DataU>{m_sharedPtr};
+    }
+
+    template <typename DataU, typename = std::enable_if_t<std::is_same_v<DataU, DataT> ||
+                                                          std::is_base_of_v<DataU, DataT>>>
+    operator SharedPtr<DataU>() &&
+    {
+        return SharedPtr<DataU>{std::move(m_sharedPtr)};
+    }
+
+    std::size_t getUseCount() const
+    {
+        return m_sharedPtr.getUseCount();
+    }
+
+    template<typename> friend class NotNullSharedPtr;
+
+    template <typename DataU, typename... ArgsT>
+    friend NotNullSharedPtr<DataU> MakeSharedPtr(ArgsT&&... args);
+
+    template <typename DataU>
+    friend NotNullSharedPtr<DataU> AsNotNullSharedPtr(SharedPtr<DataU> sharedPtr);
+
+    template <typename DataU, typename... ArgsT>
+    friend NotNullSharedPtr<DataU> MakeSharedPtrInDomain(SharedPtrDataManagementTable& domain,
+                                                         ArgsT&&... args);
+
+    template <typename DataU, typename InitT>
+    friend std::vector<NotNullSharedPtr<DataU>> MakeSharedPtrBulk(std::size_t elementCount, InitT&& init);
+
+private:
+    SharedPtr<DataT> m_sharedPtr;
+
+    explicit NotNullSharedPtr(SharedPtr<DataT>&& sharedPtr)
+    : m_sharedPtr{std::move(sharedPtr)}
+    {
+
+    }
+
+    // for data under another key, whose entry already counts the reference taken over here
+    //
+    static NotNullSharedPtr<DataT> AdoptCountedReference(DataT* data,
+                                                         void* key,
+                                                         SharedPtrDataManagementTable& managementTable)
+    {
+        SharedPtr<DataT> sharedPtr{};
+        sharedPtr.m_data = data;
+        sharedPtr.m_key = key;
+        sharedPtr.m_managementTable = &managementTable;
+        sharedPtr.trackHolder(SharedPtr<DataT>::getCreationSite());
+
+        return NotNullSharedPtr<DataT>{std::move(sharedPtr)};
+    }
+};
+
+
+// bump allocation for short-lived objects: every thread carves its new objects out of its
+// current chunk, and each chunk counts the objects still alive in it. a chunk leaves the
+// rotation some time after it fills up; when its last object dies, on whichever thread, the chunk goes back
+// to a shared pool of free ones instead of to the heap. SharedPtrs point straight at their
+// objects, so survivors can not be moved out: a chunk with long-lived objects simply stays
+// pinned until they die
+//
+class SharedPtrNursery
+{
+public:
+    static constexpr std::size_t ChunkSize{64 * 1024};
+    static constexpr std::size_t ChunkHeaderSize{64};
+    static constexpr std::size_t PageSize{4096};
+
+    struct Stats
+    {
+        std::size_t heapChunkCount{0};
+        std::size_t recycledChunkCount{0};
+        std::size_t pinnedChunkCount{0};
+    };
+
+    // objects may span pages, all but the first page of a chunk when the tails of its
+    // pages are reserved
+    //
+    static constexpr bool CanAllocate(std::size_t size, std::size_t alignment)
+    {
+        return (size + alignment <= ChunkSize - PageSize);
+    }
+
+    // the tail of every page which only MakeSharedPtrNear() places objects in, for the
+    // chunks the calling thread opens from now on; the one it has open is replaced right
+    // away. plain allocation can not use that tail, so nothing is reserved by default
+    //
+    static void SetNearReserveSize(std::size_t nearReserveSize)
+    {
+        if (nearReserveSize >= PageSize)
+        {
+            throw std::invalid_argument{"SharedPtrNursery near reserve size must be smaller than a page"};
+        }
+
+        auto& threadNursery = GetThreadNursery();
+        if (threadNursery.nearReserveSize != nearReserveSize)
+        {
+            threadNursery.nearReserveSize = nearReserveSize;
+            if (threadNursery.currentChunk)
+            {
+                threadNursery.rotateChunk();
+            }
+        }
+    }
+
+    // only for sizes CanAllocate() accepts
+    //
+    static void* Allocate(std::size_t size, std::size_t alignment)
+    {
+        auto& threadNursery = GetThreadNursery();
+        auto* data = threadNursery.currentChunk ? threadNursery.currentChunk->tryAllocate(size, alignment) : nullptr;
+        if (!data)
+        {
+            threadNursery.rotateChunk();
+            data = threadNursery.currentChunk->tryAllocate(size, alignment);
+        }
+
+        return data;
+    }
+
+    // allocates in the reserved tail of the page of hint when its chunk is one of those
+    // this thread still has open, which is told by the address alone, and like Allocate()
+    // when that tail is full, there is none, or the chunk is not open
+    //
+    static void* AllocateNear(const void* hint, std::size_t size, std::size_t alignment)
+    {
+        if (hint)
+        {
+            auto* hintChunk = Chunk::Of(hint);
+            if (GetThreadNursery().isOpen(hintChunk))
+            {
+                if (auto* data = hintChunk->tryAllocateNear(hint, size, alignment))
+                {
+                    return data;
+                }
+            }
+        }
+
+        return Allocate(size, alignment);
+    }
+
+    static void Deallocate(void* data) noexcept
+    {
+        releaseChunkReference(Chunk::Of(data));
+    }
+
+    static Stats GetStats()
+    {
+        auto& state = GetState();
+        return Stats{state.heapChunkCount.load(std::memory_order_relaxed),
+                     state.recycledChunkCount.load(std::memory_order_relaxed),
+                     state.pinnedChunkCount.load(std::memory_order_relaxed)};
+    }
+
+    // gives the pooled free chunks back to the heap
+    //
+    static void Trim()
+    {
+        auto& state = GetState();
+        std::vector<Chunk*> freeChunks;
+        {
+            const std::lock_guard<std::mutex> lock{state.mutex};
+            freeChunks.swap(state.freeChunks);
+        }
+
+        for (auto* chunk : freeChunks)
+        {
+            Chunk::Free(chunk);
+        }
+    }
+
+private:
+    // the header of every chunk, which is aligned to its size so that the chunk of any of
+    // its objects is found by masking the address
+    //
+    struct alignas(ChunkHeaderSize) Chunk
+    {
+        static constexpr std::size_t PageCount{ChunkSize / PageSize};
+
+        // the live objects, plus one while the chunk is open on its thread
+        //
+        std::atomic_size_t referenceCount{1};
+        bool isPinned{false};
+        std::uint16_t nearReserveSize;
+        std::uintptr_t nextAddress;
+
+        // where in each page the next object placed near another one of the page goes
+        //
+        std::array<std::uint16_t, PageCount> nearDataOffsets;
+
+        static Chunk* Create(std::size_t nearReserveSize)
+        {
+            auto* chunk = new (::operator new(ChunkSize, std::align_val_t{ChunkSize})) Chunk{};
+            chunk->reset(nearReserveSize);
+            return chunk;
+        }
+
+        void reset(std::size_t newNearReserveSize)
+        {
+            referenceCount.store(1, std::memory_order_relaxed);
+            isPinned = false;
+            nearReserveSize = static_cast<std::uint16_t>(newNearReserveSize);
+            nextAddress = reinterpret_cast<std::uintptr_t>(this + 1);
+            nearDataOffsets.fill(static_cast<std::uint16_t>(PageSize - nearReserveSize));
+        }
+
+        static void Free(Chunk* chunk)
+        {
+            chunk->~Chunk();
+            ::operator delete(chunk, std::align_val_t{ChunkSize});
+        }
+
+        static Chunk* Of(const void* data)
+        {
+            return reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(data) & ~(ChunkSize - 1));
+        }
+
+        // an object running into the reserved tail of the page it starts in moves on to the
+        // next page, which nothing was placed in yet. there it may run into the tails of
+        // the pages it covers, taking them
+        //
+        void* tryAllocate(std::size_t size, std::size_t alignment)
+        {
+            auto address = alignAddress(nextAddress, alignment);
+            if (nearReserveSize)
+            {
+                const auto pageStart = getPageStart(address);
+                if ((address != pageStart) && (address + size > pageStart + PageSize - nearReserveSize))
+                {
+                    address = alignAddress(pageStart + PageSize, alignment);
+                }
+            }
+
+            if (address + size > reinterpret_cast<std::uintptr_t>(this) + ChunkSize)
+            {
+                return nullptr;
+            }
+
+            if (nearReserveSize && (address + size > getPageStart(address) + PageSize - nearReserveSize))
+            {
+                takeNearReserves(address, address + size);
+            }
+
+            nextAddress = address + size;
+            referenceCount.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<void*>(address);
+        }
+
+        void* tryAllocateNear(const void* hint, std::size_t size, std::size_t alignment)
+        {
+            const auto pageStart = getPageStart(reinterpret_cast<std::uintptr_t>(hint));
+            auto& nearDataOffset = nearDataOffsets[(pageStart - reinterpret_cast<std::uintptr_t>(this)) / PageSize];
+
+            const auto address = alignAddress(pageStart + nearDataOffset, alignment);
+            if (address + size > pageStart + PageSize)
+            {
+                return nullptr;
+            }
+
+            nearDataOffset = static_cast<std::uint16_t>(address + size - pageStart);
+            referenceCount.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<void*>(address);
+        }
+
+        void takeNearReserves(std::uintptr_t begin, std::uintptr_t end)
+        {
+            for (auto pageStart = getPageStart(begin); pageStart < end; pageStart += PageSize)
+            {
+                auto& nearDataOffset = nearDataOffsets[(pageStart - reinterpret_cast<std::uintptr_t>(this)) / PageSize];
+                nearDataOffset = std::max(nearDataOffset,
+                                          static_cast<std::uint16_t>(std::min<std::uintptr_t>(end - pageStart, PageSize)));
+            }
+        }
+
+        static std::uintptr_t alignAddress(std::uintptr_t address, std::size_t alignment)
+        {
+            return (address + alignment - 1) & ~(alignment - 1);
+        }
+
+        static std::uintptr_t getPageStart(std::uintptr_t address)
+        {
+            return address & ~(PageSize - 1);
+        }
+    };
+
+    static_assert(sizeof(Chunk) == ChunkHeaderSize, "SharedPtrNursery chunk header outgrew its space");
+
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<Chunk*> freeChunks;
+
+        std::atomic_size_t heapChunkCount{0};
+        std::atomic_size_t recycledChunkCount{0};
+        std::atomic_size_t pinnedChunkCount{0};
+
+        State()
+        {
+            SharedPtrMemoryPressure::AddListener(&SharedPtrNursery::Trim);
+        }
+
+        ~State()
+        {
+            for (auto* chunk : freeChunks)
+            {
+                Chunk::Free(chunk);
+            }
+        }
+    };
+
+    // the chunks replaced last stay open for MakeSharedPtrNear() for a while, since they
+    // are rarely full to the last byte
+    //
+    static constexpr std::size_t RecentChunkCount{3};
+
+    struct ThreadNursery
+    {
+        Chunk* currentChunk{nullptr};
+        std::array<Chunk*, RecentChunkCount> recentChunks{};
+        std::size_t nearReserveSize{SharedPtrConfig::Get().nurseryNearReserveSize};
+
+        ThreadNursery() = default;
+        ThreadNursery(const ThreadNursery&) = delete;
+        ThreadNursery& operator=(const ThreadNursery&) = delete;
+
+        ~ThreadNursery()
+        {
+            for (auto* chunk : recentChunks)
+            {
+                if (chunk)
+                {
+                    retireChunk(chunk);
+                }
+            }
+
+            if (currentChunk)
+            {
+                retireChunk(currentChunk);
+            }
+        }
+
+        bool isOpen(const Chunk* chunk) const
+        {
+            return (chunk == currentChunk) ||
+                   (std::find(recentChunks.cbegin(), recentChunks.cend(), chunk) != recentChunks.cend());
+        }
+
+        void rotateChunk()
+        {
+            if (currentChunk)
+            {
+                auto* oldestChunk = recentChunks.back();
+                std::move_backward(recentChunks.begin(), recentChunks.end() - 1, recentChunks.end());
+                recentChunks.front() = std::exchange(currentChunk, nullptr);
+
+                if (oldestChunk)
+                {
+                    retireChunk(oldestChunk);
+                }
+            }
+
+            auto& state = GetState();
+            {
+                const std::lock_guard<std::mutex> lock{state.mutex};
+                if (!state.freeChunks.empty())
+                {
+                    currentChunk = state.freeChunks.back();
+                    state.freeChunks.pop_back();
+                }
+            }
+
+            if (currentChunk)
+            {
+                state.recycledChunkCount.fetch_add(1, std::memory_order_relaxed);
+                currentChunk->reset(nearReserveSize);
+            }
+            else
+            {
+                state.heapChunkCount.fetch_add(1, std::memory_order_relaxed);
+                currentChunk = Chunk::Create(nearReserveSize);
+            }
+        }
+    };
+
+    static State& GetState()
+    {
+        static State state;
+        return state;
+    }
+
+    static ThreadNursery& GetThreadNursery()
+    {
+        thread_local ThreadNursery threadNursery;
+        return threadNursery;
+    }
+
+    static void retireChunk(Chunk* chunk)
+    {
+        if (chunk->referenceCount.load(std::memory_order_relaxed) > 1)
+        {
+            chunk->isPinned = true;
+            GetState().pinnedChunkCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        releaseChunkReference(chunk);
+    }
+
+    static void releaseChunkReference(Chunk* chunk) noexcept
+    {
+        if (chunk->referenceCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return;
+        }
+
+        auto& state = GetState();
+        if (chunk->isPinned)
+        {
+            state.pinnedChunkCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock{state.mutex};
+            if (state.freeChunks.size() < SharedPtrConfig::Get().nurseryPoolSize)
+            {
+                state.freeChunks.push_back(chunk);
+                return;
+            }
+        }
+
+        Chunk::Free(chunk);
+    }
+};
+
+
+// destroys objects made by MakeSharedPtrInNursery() and gives their memory back to the chunk
+//
+template <typename DataT>
+struct SharedPtrNurseryDeleter
+{
+    void operator()(DataT* data) const
+    {
+        data->~DataT();
+        SharedPtrNursery::Deallocate(data);
+    }
+};
+
+
+// like MakeSharedPtr(), allocating from the nursery unless the object is too large for it.
+// with a hint, the object goes into the reserved tail of the page of the hint's object when
+// its chunk is still open on this thread and that tail has room left, and wherever the
+// nursery allocates next otherwise. pages only have such a tail once the calling thread
+// calls SharedPtrNursery::SetNearReserveSize() or the config sets nurseryNearReserveSize,
+// so by default the hint does nothing
+//
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrNear(const void* hint, ArgsT&&... args)
+{
+    if constexpr (!SharedPtrNursery::CanAllocate(sizeof(DataT), alignof(DataT)))
+    {
+        return AsNotNullSharedPtr(SharedPtr<DataT>{new DataT{std::forward<ArgsT>(args)...},
+                                                   SharedPtrDomainOf<DataT>::Get()});
+    }
+    else
+    {
+        auto* memory = SharedPtrNursery::AllocateNear(hint, sizeof(DataT), alignof(DataT));
+
+        DataT* data{nullptr};
+        try
+        {
+            data = new (memory) DataT{std::forward<ArgsT>(args)...};
+        }
+        catch (...)
+        {
+            SharedPtrNursery::Deallocate(memory);
+            throw;
+        }
+
+        return AsNotNullSharedPtr(SharedPtr<DataT>{data, SharedPtrNurseryDeleter<DataT>{}});
+    }
+}
+
+
+template <typename DataT, typename HintT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrNear(const SharedPtr<HintT>& hint, ArgsT&&... args)
+{
+    return MakeSharedPtrNear<DataT>(hint ? static_cast<const void*>(&*hint) : nullptr,
+                                    std::forward<ArgsT>(args)...);
+}
+
+
+template <typename DataT, typename HintT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrNear(const NotNullSharedPtr<HintT>& hint, ArgsT&&... args)
+{
+    return MakeSharedPtrNear<DataT>(static_cast<const void*>(&*hint), std::forward<ArgsT>(args)...);
+}
+
+
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrInNursery(ArgsT&&... args)
+{
+    return MakeSharedPtrNear<DataT>(static_cast<const void*>(nullptr), std::forward<ArgsT>(args)...);
+}
+
+
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtr(ArgsT&&... args)
+{
+    if (SharedPtrConfig::Get().useNursery)
+    {
+        return MakeSharedPtrInNursery<DataT>(std::forward<ArgsT>(args)...);
+    }
+
+    // new data is of type DataT exactly and not managed anywhere yet, so its domain is known
+    //
+    return NotNullSharedPtr<DataT>{SharedPtr<DataT>{new DataT{std::forward<ArgsT>(args)...},
+                                                    SharedPtrDomainOf<DataT>::Get()}};
+}
+
+
+template <typename DataT, typename... ArgsT>
+NotNullSharedPtr<DataT> MakeSharedPtrInDomain(SharedPtrDataManagementTable& domain, ArgsT&&... args)
+{
+    return NotNullSharedPtr<DataT>{SharedPtr<DataT>{new DataT{std::forward<ArgsT>(args)...}, domain}};
+}
+
+
+template <typename DataT>
+NotNullSharedPtr<DataT> AsNotNullSharedPtr(SharedPtr<DataT> sharedPtr)
+{
+    if (!sharedPtr)
+    {
+        throw std::logic_error{"AsNotNullSharedPtr called with null SharedPtr"};
+    }
+
+    return NotNullSharedPtr<DataT>{std::move(sharedPtr)};
+}
+
+
+// an OS or C library handle, like a file descriptor, a mapping or a FILE*, shared the way
+// SharedPtr shares data and released by its deleter once the last SharedResource lets go
+// of it. the handles are keys of a domain of their own per handle type, so sharing one
+// allocates nothing unless its deleter has state
+//
+template <typename HandleT>
+class SharedResource
+{
+public:
+    static_assert((std::is_integral_v<HandleT> && (sizeof(HandleT) <= sizeof(std::uint32_t))) ||
+                  std::is_pointer_v<HandleT>,
+                  "SharedResource supports pointer handles and integral ones of up to 32 bits");
+
+    SharedResource() = default;
+
+    template <typename DeleterT, typename = std::enable_if_t<std::is_invocable_v<DeleterT&, HandleT>>>
+    SharedResource(HandleT handle, DeleterT deleter)
+    : m_handle{handle},
+      m_key{toKey(handle)}
+    {
+        if constexpr (IsStatelessDeleter<DeleterT>)
+        {
+            GetDomain().addDataWithDeleter(m_key,
+                                           m_key,
+                                           SharedPtrDeleterRegistry::GetFunctionId<&deleteHandleWith<DeleterT>>());
+        }
+        else
+        {
+            GetDomain().addDataWithDeleter(m_key,
+                                           m_key,
+                                           SharedPtrDeleterRegistry::CustomDeleterId,
+                                           [deleter = std::move(deleter)](void* key) mutable
+                                           {
+                                               deleter(toHandle(key));
+                                           });
+        }
+    }
+
+    SharedResource(const SharedResource& other)
+    : m_handle{other.m_handle},
+      m_key{other.m_key}
+    {
+        if (m_key && !GetDomain().addDataIfManaged(m_key))
+        {
+            m_key = nullptr;
+        }
+    }
+
+    SharedResource(SharedResource&& other) noexcept
+    : m_handle{other.m_handle},
+      m_key{std::exchange(other.m_key, nullptr)}
+    {
+
+    }
+
+    SharedResource& operator=(SharedResource other) noexcept
+    {
+        std::swap(m_handle, other.m_handle);
+        std::swap(m_key, other.m_key);
+        return *this;
+    }
+
+    ~SharedResource()
+    {
+        if (m_key)
+        {
+            GetDomain().removeData(m_key);
+        }
+    }
+
+    // only meaningful while this SharedResource is not empty
+    //
+    HandleT get() const
+    {
+        return m_handle;
+    }
+
+    explicit operator bool() const
+    {
+        return m_key;
+    }
+
+    std::size_t getUseCount() const
+    {
+        return m_key ? GetDomain().getKeyCount(m_key) : 0;
+    }
+
+    // handles get closed by whichever thread lets go of them last, even when the config
+    // returns the data of the other domains to their creator threads
+    //
+    static SharedPtrDataManagementTable& GetDomain()
+    {
+        static auto& domain = SharedPtrDataManagementTable::GetDomain(std::string{"resource:"} +
+                                                                      typeid(HandleT).name(),
+                                                                      []()
+        {
+            auto policy = SharedPtrConfig::Get().defaultPolicy;
+            policy.returnToCreatorThread = false;
+            return policy;
+        }());
+        return domain;
+    }
+
+private:
+    HandleT m_handle{};
+    void* m_key{nullptr};
+
+    // integral handles are offset by one, so that no valid one turns into a null key
+    //
+    static void* toKey(HandleT handle)
+    {
+        if constexpr (std::is_pointer_v<HandleT>)
+        {
+            if (!handle)
+            {
+                throw std::logic_error{"SharedResource constructed with null handle"};
+            }
+
+            return reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(handle));
+        }
+        else
+        {
+            using UnsignedHandle = std::make_unsigned_t<HandleT>;
+            return reinterpret_cast<void*>(static_cast<std::uintptr_t>(static_cast<UnsignedHandle>(handle)) + 1);
+        }
+    }
+
+    static HandleT toHandle(void* key)
+    {
+        if constexpr (std::is_pointer_v<HandleT>)
+        {
+            return reinterpret_cast<HandleT>(reinterpret_cast<std::uintptr_t>(key));
+        }
+        else
+        {
+            using UnsignedHandle = std::make_unsigned_t<HandleT>;
+            return static_cast<HandleT>(static_cast<UnsignedHandle>(reinterpret_cast<std::uintptr_t>(key) - 1));
+        }
+    }
+
+    template <typename DeleterT>
+    static void deleteHandleWith(void* key)
+    {
+        DeleterT{}(toHandle(key));
+    }
+};
+
+
+// the single allocation behind MakeSharedPtrBulk(): this header, followed by the
+// elements. it is what the table entry deletes, all the elements at once
+//
+template <typename DataT>
+class SharedPtrBulkBlock
+{
+public:
+    static_assert(alignof(DataT) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                  "MakeSharedPtrBulk does not support over-aligned types");
+
+    template <typename InitT>
+    static SharedPtrBulkBlock* Create(std::size_t elementCount, InitT&& init)
+    {
+        auto* block = new (elementCount) SharedPtrBulkBlock{};
+
+        try
+        {
+            for (; block->m_elementCount < elementCount; ++block->m_elementCount)
+            {
+                if constexpr (std::is_invocable_v<InitT&, std::size_t>)
+                {
+                    new (block->getElement(block->m_elementCount)) DataT{init(block->m_elementCount)};
+                }
+                else
+                {
+                    new (block->getElement(block->m_elementCount)) DataT{init};
+                }
+            }
+        }
+        catch (...)
+        {
+            delete block;
+            throw;
+        }
+
+        return block;
+    }
+
+    SharedPtrBulkBlock(const SharedPtrBulkBlock&) = delete;
+    SharedPtrBulkBlock& operator=(const SharedPtrBulkBlock&) = delete;
+    SharedPtrBulkBlock(SharedPtrBulkBlock&&) = delete;
+    SharedPtrBulkBlock& operator=(SharedPtrBulkBlock&&) = delete;
+
+    ~SharedPtrBulkBlock()
+    {
+        if (m_aliasTable)
+        {
+            m_aliasTable->removeAliasRange(getElement(0), getElement(m_elementCount));
+        }
+
+        while (m_elementCount)
+        {
+            getElement(--m_elementCount)->~DataT();
+        }
+    }
+
+    static void* operator new(std::size_t, std::size_t elementCount)
+    {
+        return ::operator new(ElementsOffset + elementCount * sizeof(DataT));
+    }
+
+    static void operator delete(void* memory)
+    {
+        ::operator delete(memory);
+    }
+
+    DataT* getElement(std::size_t index)
+    {
+        return reinterpret_cast<DataT*>(reinterpret_cast<unsigned char*>(this) + ElementsOffset) + index;
+    }
+
+    // lets the elements be adopted through their raw pointers, which find the entry of
+    // the block in managementTable
+    //
+    void aliasElements(SharedPtrDataManagementTable& managementTable)
+    {
+        managementTable.addAliasRange(getElement(0), getElement(m_elementCount), this);
+        m_aliasTable = &managementTable;
+    }
+
+private:
+    static constexpr std::size_t ElementsOffset{(sizeof(std::size_t) + sizeof(SharedPtrDataManagementTable*) +
+                                                 alignof(DataT) - 1) / alignof(DataT) * alignof(DataT)};
+
+    std::size_t m_elementCount{0};
+    SharedPtrDataManagementTable* m_aliasTable{nullptr};
+
+    SharedPtrBulkBlock() = default;
+};
+
+
+// constructs elementCount objects next to each other in a single allocation, which gets
+// a single table entry, and returns one SharedPtr per element, all of them keeping the
+// whole block alive. init is either called with the index of each element or copied into
+// every one of them. the elements are no table keys of their own, adopting one through
+// its raw pointer adds a holder to the entry of the block instead
+//
+template <typename DataT, typename InitT>
+std::vector<NotNullSharedPtr<DataT>> MakeSharedPtrBulk(std::size_t elementCount, InitT&& init)
+{
+    std::vector<NotNullSharedPtr<DataT>> sharedPtrs;
+    if (!elementCount)
+    {
+        return sharedPtrs;
+    }
+
+    sharedPtrs.reserve(elementCount);
+
+    // the block is only owned by its entry once that exists
+    //
+    std::unique_ptr<SharedPtrBulkBlock<DataT>> block{SharedPtrBulkBlock<DataT>::Create(elementCount,
+                                                                                         std::forward<InitT>(init))};
+    auto& managementTable = SharedPtrDomainOf<DataT>::Get();
+    block->aliasElements(managementTable);
+    managementTable.addData(block.get(), block.get(), elementCount);
+
+    for (std::size_t index{0}; index < elementCount; ++index)
+    {
+        sharedPtrs.push_back(NotNullSharedPtr<DataT>::AdoptCountedReference(block->getElement(index),
+                                                                            block.get(),
+                                                                            managementTable));
+    }
+
+    block.release();
+    return sharedPtrs;
+}
+
+
+// the commit clock of the versioned cells. commits are sequenced one at a time, and the
+// clock only moves past a commit once all of its versions are published, so a snapshot
+// taken at the current time sees every commit up to it or none of one. the active
+// snapshots are registered so that writers know which old versions someone may still read
+//
+class SharedPtrVersionClock
+{
+public:
+    static std::uint64_t GetTime()
+    {
+        return GetState().time.load(std::memory_order_acquire);
+    }
+
+    // the oldest time an active snapshot reads at, or the current time without any
+    //
+    static std::uint64_t GetOldestSnapshotTime()
+    {
+        auto& state = GetState();
+        const std::lock_guard<std::mutex> lock{state.snapshotMutex};
+
+        if (state.snapshotCounts.empty())
+        {
+            return state.time.load(std::memory_order_relaxed);
+        }
+
+        return state.snapshotCounts.cbegin()->first;
+    }
+
+private:
+    struct State
+    {
+        std::atomic<std::uint64_t> time{0};
+        std::mutex commitMutex;
+
+        std::mutex snapshotMutex;
+        std::map<std::uint64_t, std::size_t> snapshotCounts;
+    };
+
+    static State& GetState()
+    {
+        static State state;
+        return state;
+    }
+
+    friend class SharedPtrSnapshot;
+    friend class SharedPtrCommit;
+};
+
+
+// reads of versioned cells at a fixed time, for as long as it lives
+//
+class SharedPtrSnapshot
+{
+public:
+    SharedPtrSnapshot()
+    {
+        auto& state = SharedPtrVersionClock::GetState();
+        const std::lock_guard<std::mutex> lock{state.snapshotMutex};
+
+        m_time = state.time.load(std::memory_order_acquire);
+        ++state.snapshotCounts[m_time];
+    }
+
+    SharedPtrSnapshot(const SharedPtrSnapshot&) = delete;
+    SharedPtrSnapshot& operator=(const SharedPtrSnapshot&) = delete;
+    SharedPtrSnapshot(SharedPtrSnapshot&&) = delete;
+    SharedPtrSnapshot& operator=(SharedPtrSnapshot&&) = delete;
+
+    ~SharedPtrSnapshot()
+    {
+        auto& state = SharedPtrVersionClock::GetState();
+        const std::lock_guard<std::mutex> lock{state.snapshotMutex};
+
+        const auto countItr = state.snapshotCounts.find(m_time);
+        if (--countItr->second == 0)
+        {
+            state.snapshotCounts.erase(countItr);
+        }
+    }
+
+    std::uint64_t getTime() const
+    {
+        return m_time;
+    }
+
+private:
+    std::uint64_t m_time;
+};
+
+
+// writes of versioned cells which become visible together, at the time of the commit,
+// when it goes out of scope. other commits wait for it meanwhile
+//
+class SharedPtrCommit
+{
+public:
+    SharedPtrCommit()
+    : m_lock{SharedPtrVersionClock::GetState().commitMutex},
+      m_time{SharedPtrVersionClock::GetState().time.load(std::memory_order_relaxed) + 1}
+    {
+
+    }
+
+    SharedPtrCommit(const SharedPtrCommit&) = delete;
+    SharedPtrCommit& operator=(const SharedPtrCommit&) = delete;
+    SharedPtrCommit(SharedPtrCommit&&) = delete;
+    SharedPtrCommit& operator=(SharedPtrCommit&&) = delete;
+
+    ~SharedPtrCommit()
+    {
+        SharedPtrVersionClock::GetState().time.store(m_time, std::memory_order_release);
+    }
+
+    std::uint64_t getTime() const
+    {
+        return m_time;
+    }
+
+private:
+    const std::unique_lock<std::mutex> m_lock;
+    const std::uint64_t m_time;
+};
+
+
+// a value with its recent versions, newest first, each one tagged with the time it was
+// committed at. readers walk the chain without locking anything and stop at the first
+// version their snapshot can see; writers cut the chain below the version the oldest
+// active snapshot sees, which no reader walks past, and release what they cut off
+//
+template <typename DataT>
+class VersionedCell
+{
+public:
+    VersionedCell() = default;
+
+    explicit VersionedCell(SharedPtr<DataT> initialValue)
+    {
+        write(std::move(initialValue));
+    }
+
+    VersionedCell(const VersionedCell&) = delete;
+    VersionedCell& operator=(const VersionedCell&) = delete;
+    VersionedCell(VersionedCell&&) = delete;
+    VersionedCell& operator=(VersionedCell&&) = delete;
+
+    ~VersionedCell()
+    {
+        releaseVersions(m_newestVersion.load(std::memory_order_relaxed));
+    }
+
+    // the data stays valid for as long as the snapshot lives
+    //
+    const DataT* read(const SharedPtrSnapshot& snapshot) const
+    {
+        const auto* version = findVersion(snapshot.getTime());
+        return version ? &*version->data : nullptr;
+    }
+
+    // for keeping the data beyond the snapshot
+    //
+    SharedPtr<DataT> readShared(const SharedPtrSnapshot& snapshot) const
+    {
+        const auto* version = findVersion(snapshot.getTime());
+        return version ? version->data : SharedPtr<DataT>{};
+    }
+
+    std::uint64_t write(SharedPtr<DataT> data)
+    {
+        const SharedPtrCommit commit;
+        write(std::move(data), commit);
+        return commit.getTime();
+    }
+
+    void write(SharedPtr<DataT> data, const SharedPtrCommit& commit)
+    {
+        auto* previousVersion = m_newestVersion.load(std::memory_order_relaxed);
+        if (previousVersion && (previousVersion->commitTime == commit.getTime()))
+        {
+            throw std::logic_error{"VersionedCell::write called twice within the same commit"};
+        }
+
+        m_newestVersion.store(new Version{std::move(data), commit.getTime(), previousVersion},
+                              std::memory_order_release);
+
+        releaseInvisibleVersions();
+    }
+
+    // releases the versions no active snapshot can see anymore, which writes do as well
+    //
+    void pruneVersions()
+    {
+        const SharedPtrCommit commit;
+        releaseInvisibleVersions();
+    }
+
+    std::size_t getVersionCount() const
+    {
+        std::size_t versionCount{0};
+        for (auto* version = m_newestVersion.load(std::memory_order_acquire);
+             version;
+             version = version->olderVersion.load(std::memory_order_acquire))
+        {
+            ++versionCount;
+        }
+
+        return versionCount;
+    }
+
+private:
+    struct Version
+    {
+        SharedPtr<DataT> data;
+        std::uint64_t commitTime;
+        std::atomic<Version*> olderVersion;
+    };
+
+    std::atomic<Version*> m_newestVersion{nullptr};
+
+    const Version* findVersion(std::uint64_t snapshotTime) const
+    {
+        auto* version = m_newestVersion.load(std::memory_order_acquire);
+        while (version && (version->commitTime > snapshotTime))
+        {
+            version = version->olderVersion.load(std::memory_order_acquire);
+        }
+
+        return version;
+    }
+
+    // only called within a commit, which keeps other writers out
+    //
+    void releaseInvisibleVersions()
+    {
+        const auto oldestSnapshotTime = SharedPtrVersionClock::GetOldestSnapshotTime();
+        auto* version = m_newestVersion.load(std::memory_order_relaxed);
+        while (version && (version->commitTime > oldestSnapshotTime))
+        {
+            version = version->olderVersion.load(std::memory_order_relaxed);
+        }
+
+        if (version)
+        {
+            releaseVersions(version->olderVersion.exchange(nullptr, std::memory_order_relaxed));
+        }
+    }
+
+    static void releaseVersions(Version* version)
+    {
+        while (version)
+        {
+            delete std::exchange(version, version->olderVersion.load(std::memory_order_relaxed));
+        }
+    }
+};
+
+
+// a SharedPtr read by every thread all the time: each thread keeps its own copy and only
+// revalidates it against the version of the global one, a single relaxed load, so reading
+// touches no reference count unless a writer published in between. the copies are released
+// when their thread exits or the GlobalShared is destroyed, whichever comes first, and the
+// slots of destroyed GlobalShareds are reused by the ones created afterwards
+//
+template <typename DataT>
+class GlobalShared
+{
+public:
+    explicit GlobalShared(SharedPtr<DataT> data = {})
+    : m_data{std::move(data)}
+    {
+
+    }
+
+    GlobalShared(const GlobalShared&) = delete;
+    GlobalShared& operator=(const GlobalShared&) = delete;
+    GlobalShared(GlobalShared&&) = delete;
+    GlobalShared& operator=(GlobalShared&&) = delete;
+
+    // no thread may be in get() anymore, so their copies are reset under the lock of their
+    // thread only against growing, and released after unlocking as they may be the last
+    // holders of their data
+    //
+    ~GlobalShared()
+    {
+        std::vector<SharedPtr<DataT>> releasedCopies;
+        {
+            auto& registry = GetRegistry();
+            const std::lock_guard<std::mutex> lock{registry.mutex};
+
+            for (auto* threadCopies : registry.threadCopies)
+            {
+                const std::lock_guard<std::mutex> threadLock{threadCopies->mutex};
+                if (m_id < threadCopies->copies.size())
+                {
+                    auto& cachedCopy = threadCopies->copies[m_id];
+                    releasedCopies.push_back(std::move(cachedCopy.data));
+                    cachedCopy.version = 0;
+                }
+            }
+
+            registry.freeIds.push_back(m_id);
+        }
+    }
+
+    // the reference stays valid until this thread calls get() on this GlobalShared again
+    //
+    const SharedPtr<DataT>& get() const
+    {
+        auto& cachedCopy = getCachedCopy();
+        if (cachedCopy.version != m_version.load(std::memory_order_relaxed))
+        {
+            const std::lock_guard<std::mutex> lock{m_mutex};
+
+            cachedCopy.data = m_data;
+            cachedCopy.version = m_version.load(std::memory_order_relaxed);
+        }
+
+        return cachedCopy.data;
+    }
+
+    // the previous data may get deleted here, which is left for after unlocking
+    //
+    void publish(SharedPtr<DataT> data)
+    {
+        SharedPtr<DataT> previousData;
+        {
+            const std::lock_guard<std::mutex> lock{m_mutex};
+
+            previousData = std::exchange(m_data, std::move(data));
+            m_version.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct CachedCopy
+    {
+        SharedPtr<DataT> data;
+        std::uint64_t version{0};
+    };
+
+    // the copies of one thread, indexed by the ids of the GlobalShareds. a deque, so that
+    // growing it leaves the copies handed out where they are
+    //
+    struct ThreadCopies
+    {
+        std::mutex mutex;
+        std::deque<CachedCopy> copies;
+
+        ThreadCopies()
+        {
+            auto& registry = GetRegistry();
+            const std::lock_guard<std::mutex> lock{registry.mutex};
+
+            registry.threadCopies.push_back(this);
+        }
+
+        ~ThreadCopies()
+        {
+            auto& registry = GetRegistry();
+            const std::lock_guard<std::mutex> lock{registry.mutex};
+
+            registry.threadCopies.erase(std::find(registry.threadCopies.begin(), registry.threadCopies.end(), this));
+        }
+    };
+
+    // the ids free for reuse and the copies of every thread, never destroyed as threads
+    // may still exit while static storage goes away
+    //
+    struct Registry
+    {
+        std::mutex mutex;
+        std::size_t nextId{0};
+        std::vector<std::size_t> freeIds;
+        std::vector<ThreadCopies*> threadCopies;
+    };
+
+    mutable std::mutex m_mutex;
+    SharedPtr<DataT> m_data;
+
+    // a reused id starts over at the first version, which the copies reset on destruction
+    // never match
+    //
+    std::atomic<std::uint64_t> m_version{1};
+    const std::size_t m_id{AcquireId()};
+
+    static Registry& GetRegistry()
+    {
+        static auto* registry = new Registry{};
+        return *registry;
+    }
+
+    static std::size_t AcquireId()
+    {
+        auto& registry = GetRegistry();
+        const std::lock_guard<std::mutex> lock{registry.mutex};
+
+        if (registry.freeIds.empty())
+        {
+            return registry.nextId++;
+        }
+
+        const auto id = registry.freeIds.back();
+        registry.freeIds.pop_back();
+        return id;
+    }
+
+    CachedCopy& getCachedCopy() const
+    {
+        thread_local ThreadCopies threadCopies;
+        if (m_id >= threadCopies.copies.size())
+        {
+            const std::lock_guard<std::mutex> lock{threadCopies.mutex};
+
+            threadCopies.copies.resize(m_id + 1);
+        }
+
+        return threadCopies.copies[m_id];
+    }
+};
+
+
+// the hooks Freeze() needs for every type of its graph, to be specialized next to the type:
+//
+//     using Frozen = ...;   the read-only counterpart, with FrozenRefs instead of SharedPtrs
+//     static void Trace(const DataT& data, VisitorT&& visit);
+//         calls visit(sharedPtr) for every SharedPtr edge of data
+//     static void Freeze(const DataT& data, Frozen& frozen, SharedPtrFreezer& freezer);
+//         fills in frozen, its edges through freezer.link()
+//
+template <typename DataT>
+struct SharedPtrFreezeTraits;
+
+
+// an edge of a frozen graph: where its target lies relative to the FrozenRef itself, so
+// following it costs no counting and the blob needs no fixing up wherever it is
+//
+template <typename DataT>
+class FrozenRef
+{
+public:
+    FrozenRef() = default;
+
+    FrozenRef(const FrozenRef&) = delete;
+    FrozenRef& operator=(const FrozenRef&) = delete;
+
+    const DataT* get() const
+    {
+        if (m_offset == NullOffset)
+        {
+            return nullptr;
+        }
+
+        return reinterpret_cast<const DataT*>(reinterpret_cast<const unsigned char*>(this) + m_offset);
+    }
+
+    const DataT* operator->() const
+    {
+        assert(m_offset != NullOffset);
+
+        return get();
+    }
+
+    const DataT& operator*() const
+    {
+        assert(m_offset != NullOffset);
+
+        return *get();
+    }
+
+    explicit operator bool() const
+    {
+        return m_offset != NullOffset;
+    }
+
+private:
+    static constexpr std::ptrdiff_t NullOffset{PTRDIFF_MIN};
+
+    std::ptrdiff_t m_offset{NullOffset};
+
+    void set(const DataT* data)
+    {
+        m_offset = reinterpret_cast<const unsigned char*>(data) - reinterpret_cast<const unsigned char*>(this);
+    }
+
+    friend class SharedPtrFreezer;
+};
+
+
+// lays out the graph reachable from a root in one block, every node once, however many
+// edges lead to it, and then freezes the nodes into their places
+//
+class SharedPtrFreezer
+{
+public:
+    SharedPtrFreezer(const SharedPtrFreezer&) = delete;
+    SharedPtrFreezer& operator=(const SharedPtrFreezer&) = delete;
+
+    template <typename DataT>
+    void link(FrozenRef<typename SharedPtrFreezeTraits<DataT>::Frozen>& frozenRef, const SharedPtr<DataT>& sharedPtr)
+    {
+        using Frozen = typename SharedPtrFreezeTraits<DataT>::Frozen;
+
+        if (sharedPtr)
+        {
+            frozenRef.set(reinterpret_cast<const Frozen*>(m_blob + m_offsets.at(&*sharedPtr)));
+        }
+    }
+
+private:
+    struct Node
+    {
+        const void* data;
+        std::size_t offset;
+        void (*trace)(const void* data, SharedPtrFreezer& freezer);
+        void (*freeze)(const void* data, void* frozen, SharedPtrFreezer& freezer);
+    };
+
+    std::vector<Node> m_nodes;
+    std::unordered_map<const void*, std::size_t> m_offsets;
+    std::size_t m_size{0};
+    unsigned char* m_blob{nullptr};
+
+    SharedPtrFreezer() = default;
+
+    template <typename DataT>
+    void addNode(const SharedPtr<DataT>& sharedPtr)
+    {
+        using Frozen = typename SharedPtrFreezeTraits<DataT>::Frozen;
+
+        static_assert(std::is_trivially_destructible_v<Frozen>,
+                      "frozen types are released with their blob, without being destroyed");
+        static_assert(alignof(Frozen) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                      "Freeze does not support over-aligned frozen types");
+
+        if (!sharedPtr || m_offsets.count(&*sharedPtr))
+        {
+            return;
+        }
+
+        const auto offset = (m_size + alignof(Frozen) - 1) / alignof(Frozen) * alignof(Frozen);
+        m_size = offset + sizeof(Frozen);
+
+        m_offsets.emplace(&*sharedPtr, offset);
+        m_nodes.push_back(Node{&*sharedPtr, offset, &traceNode<DataT>, &freezeNode<DataT>});
+    }
+
+    template <typename DataT>
+    static void traceNode(const void* data, SharedPtrFreezer& freezer)
+    {
+        SharedPtrFreezeTraits<DataT>::Trace(*static_cast<const DataT*>(data), [&freezer](const auto& sharedPtr)
+        {
+            freezer.addNode(sharedPtr);
+        });
+    }
+
+    template <typename DataT>
+    static void freezeNode(const void* data, void* frozen, SharedPtrFreezer& freezer)
+    {
+        using Frozen = typename SharedPtrFreezeTraits<DataT>::Frozen;
+
+        SharedPtrFreezeTraits<DataT>::Freeze(*static_cast<const DataT*>(data), *new (frozen) Frozen{}, freezer);
+    }
+
+    template <typename DataT>
+    struct BlobDeleter
+    {
+        void operator()(const DataT* blob) const
+        {
+            ::operator delete(const_cast<DataT*>(blob));
+        }
+    };
+
+    template <typename DataT>
+    friend SharedPtr<const typename SharedPtrFreezeTraits<DataT>::Frozen> Freeze(const SharedPtr<DataT>& root);
+};
+
+
+// copies the graph reachable from root into a single read-only block, the frozen root at
+// its start, which the returned SharedPtr releases all at once. the graph is only read,
+// and must not change meanwhile
+//
+template <typename DataT>
+SharedPtr<const typename SharedPtrFreezeTraits<DataT>::Frozen> Freeze(const SharedPtr<DataT>& root)
+{
+    using Frozen = typename SharedPtrFreezeTraits<DataT>::Frozen;
+
+    if (!root)
+    {
+        return {};
+    }
+
+    SharedPtrFreezer freezer;
+    freezer.addNode(root);
+
+    // the nodes added while tracing are traced in turn, breadth first
+    //
+    for (std::size_t nodeIndex{0}; nodeIndex < freezer.m_nodes.size(); ++nodeIndex)
+    {
+        const auto node = freezer.m_nodes[nodeIndex];
+        node.trace(node.data, freezer);
+    }
+
+    freezer.m_blob = static_cast<unsigned char*>(::operator new(freezer.m_size));
+    try
+    {
+        for (const auto& node : freezer.m_nodes)
+        {
+            node.freeze(node.data, freezer.m_blob + node.offset, freezer);
+        }
+    }
+    catch (...)
+    {
+        ::operator delete(freezer.m_blob);
+        throw;
+    }
+
+    return SharedPtr<const Frozen>{reinterpret_cast<const Frozen*>(freezer.m_blob),
+                                   SharedPtrFreezer::BlobDeleter<Frozen>{}};
+}
+
+
+// hammers one table from several threads with random adopt, copy, move, release and
+// getUseCount sequences, and stops them every round to check the table against a model
+// of who holds what: every count must match, no object may be alive unheld or deleted
+// twice, and nothing may be left behind at the end. the schedules shake the interleavings
+// differently: Free lets the threads run, Yielding gives up the cpu at random points and
+// Lockstep moves all threads one operation at a time, all of them on the same object.
+// Migrating has the threads adopt in their thread-local tables instead, and pass objects
+// to each other through a mailbox after shareAcrossThreads(), so that they get released
+// on other threads than the one which created them
+//
+class SharedPtrTortureTest
+{
+public:
+    enum class Schedule
+    {
+        Free,
+        Yielding,
+        Lockstep,
+        Migrating
+    };
+
+    struct Options
+    {
+        Schedule schedule{Schedule::Free};
+        std::size_t threadCount{4};
+        std::size_t roundCount{8};
+        std::size_t operationsPerRound{2000};
+        std::size_t slotsPerThread{16};
+        std::size_t sharedObjectCount{8};
+        std::uint64_t seed{1};
+    };
+
+    struct Result
+    {
+        std::size_t operationCount{0};
+        double seconds{0};
+        std::vector<std::string> failures;
+
+        bool passed() const
+        {
+            return failures.empty();
+        }
+
+        double getOperationsPerSecond() const
+        {
+            return seconds > 0 ? operationCount / seconds : 0;
+        }
+    };
+
+    static const char* GetScheduleName(Schedule schedule)
+    {
+        switch (schedule)
+        {
+            case Schedule::Free:
+                return "free";
+
+            case Schedule::Yielding:
+                return "yielding";
+
+            case Schedule::Lockstep:
+                return "lockstep";
+
+            case Schedule::Migrating:
+                return "migrating";
+        }
+
+        return "unknown";
+    }
+
+    static Result Run(SharedPtrDataManagementTable& table, const Options& options)
+    {
+        if (!options.threadCount || !options.slotsPerThread || !options.sharedObjectCount)
+        {
+            throw std::invalid_argument{"SharedPtrTortureTest needs threads, slots and shared objects"};
+        }
+
+        Counters counters;
+        Result result;
+
+        std::vector<SharedPtr<Object>> sharedObjects;
+        for (std::size_t objectIndex{0}; objectIndex < options.sharedObjectCount; ++objectIndex)
+        {
+            sharedObjects.emplace_back(MakeSharedPtrInDomain<Object>(table, counters));
+        }
+
+        Mailbox mailbox;
+        mailbox.slots.resize(options.sharedObjectCount);
+
+        std::vector<ThreadState> threadStates(options.threadCount);
+        for (std::size_t threadIndex{0}; threadIndex < options.threadCount; ++threadIndex)
+        {
+            threadStates[threadIndex].slots.resize(options.slotsPerThread);
+            threadStates[threadIndex].random.seed(options.seed * 0x9E3779B97F4A7C15ull + threadIndex);
+        }
+
+        for (std::size_t roundIndex{0}; roundIndex < options.roundCount; ++roundIndex)
+        {
+            Barrier barrier{options.threadCount};
+            const auto startTime = std::chrono::steady_clock::now();
+
+            std::vector<std::thread> threads;
+            for (auto& threadState : threadStates)
+            {
+                threads.emplace_back([&, roundIndex]
+                {
+                    runRound(table, options, roundIndex, sharedObjects, mailbox, threadState, counters, barrier);
+                });
+            }
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+
+            result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            result.operationCount += options.threadCount * options.operationsPerRound;
+
+            checkQuiescentState(sharedObjects, mailbox, threadStates, counters, roundIndex, result.failures);
+        }
+
+        for (auto& threadState : threadStates)
+        {
+            for (auto& failure : threadState.failures)
+            {
+                result.failures.push_back(std::move(failure));
+            }
+        }
+
+        threadStates.clear();
+        sharedObjects.clear();
+        mailbox.slots.clear();
+
+        if (counters.destroyedCount != counters.createdCount)
+        {
+            result.failures.push_back(std::to_string(counters.createdCount - counters.destroyedCount)
+                                      + " objects leaked");
+        }
+
+        if (counters.doubleDeleteCount)
+        {
+            result.failures.push_back(std::to_string(counters.doubleDeleteCount.load()) + " objects deleted twice");
+        }
+
+        return result;
+    }
+
+private:
+    struct Counters
+    {
+        std::atomic_size_t createdCount{0};
+        std::atomic_size_t destroyedCount{0};
+        std::atomic_size_t doubleDeleteCount{0};
+    };
+
+    // deleting one twice is undefined behaviour anyway, so the magic only catches what
+    // survives it; the sanitizer builds catch the rest
+    //
+    struct Object
+    {
+        static constexpr std::uint64_t AliveMagic{0xA11CE0B1EC7A11FEull};
+        static constexpr std::uint64_t DeadMagic{0xDEADDEADDEADDEADull};
+
+        Counters& counters;
+        std::atomic<std::uint64_t> magic{AliveMagic};
+
+        explicit Object(Counters& counters)
+        : counters{counters}
+        {
+            ++counters.createdCount;
+        }
+
+        Object(const Object&) = delete;
+        Object& operator=(const Object&) = delete;
+
+        ~Object()
+        {
+            if (magic.exchange(DeadMagic) != AliveMagic)
+            {
+                ++counters.doubleDeleteCount;
+            }
+
+            ++counters.destroyedCount;
+        }
+    };
+
+    struct ThreadState
+    {
+        std::vector<SharedPtr<Object>> slots;
+        std::mt19937_64 random;
+        std::vector<std::string> failures;
+    };
+
+    // where the Migrating schedule leaves objects for the other threads to pick up
+    //
+    struct Mailbox
+    {
+        std::mutex mutex;
+        std::vector<SharedPtr<Object>> slots;
+    };
+
+    class Barrier
+    {
+    public:
+        explicit Barrier(std::size_t threadCount)
+        : m_threadCount{threadCount}
+        {
+
+        }
+
+        void arriveAndWait()
+        {
+            const auto generation = m_generation.load(std::memory_order_acquire);
+            if (m_arrivedCount.fetch_add(1, std::memory_order_acq_rel) + 1 == m_threadCount)
+            {
+                m_arrivedCount.store(0, std::memory_order_relaxed);
+                m_generation.fetch_add(1, std::memory_order_release);
+                return;
+            }
+
+            while (m_generation.load(std::memory_order_acquire) == generation)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        const std::size_t m_threadCount;
+        std::atomic_size_t m_arrivedCount{0};
+        std::atomic_size_t m_generation{0};
+    };
+
+    static void runRound(SharedPtrDataManagementTable& table,
+                         const Options& options,
+                         std::size_t roundIndex,
+                         const std::vector<SharedPtr<Object>>& sharedObjects,
+                         Mailbox& mailbox,
+                         ThreadState& threadState,
+                         Counters& counters,
+                         Barrier& barrier)
+    {
+        auto& slots = threadState.slots;
+        auto& random = threadState.random;
+        const auto isMigrating = options.schedule == Schedule::Migrating;
+
+        for (std::size_t operationIndex{0}; operationIndex < options.operationsPerRound; ++operationIndex)
+        {
+            auto& slot = slots[random() % slots.size()];
+            auto& otherSlot = slots[random() % slots.size()];
+            auto sharedObjectIndex = random() % sharedObjects.size();
+
+            if (options.schedule == Schedule::Yielding && random() % 4 == 0)
+            {
+                std::this_thread::yield();
+            }
+            else if (options.schedule == Schedule::Lockstep)
+            {
+                barrier.arriveAndWait();
+                sharedObjectIndex = (roundIndex * options.operationsPerRound + operationIndex) % sharedObjects.size();
+            }
+
+            // the table throws when it finds itself broken, which fails the thread like any
+            // other broken invariant
+            //
+            try
+            {
+                switch (random() % (isMigrating ? 9 : 7))
+                {
+                    case 0:
+                        slot = MakeSharedPtrInDomain<Object>(isMigrating ?
+                                                                 SharedPtrDataManagementTable::GetThreadLocalInstance() :
+                                                                 table,
+                                                             counters);
+                        break;
+
+                    case 1:
+                    case 2:
+                        slot = sharedObjects[sharedObjectIndex];
+                        break;
+
+                    case 3:
+                        slot = otherSlot;
+                        break;
+
+                    case 4:
+                        if (&slot != &otherSlot)
+                        {
+                            slot = std::move(otherSlot);
+                        }
+                        break;
+
+                    case 5:
+                        // adopting an already managed pointer again is just another holder.
+                        // thread-local objects are not in table, so they are only tried
+                        //
+                        if (otherSlot && isMigrating)
+                        {
+                            slot = SharedPtr<Object>::TryAdopt(&*otherSlot, table);
+                        }
+                        else if (otherSlot)
+                        {
+                            slot = SharedPtr<Object>{&*otherSlot, table};
+                        }
+                        break;
+
+                    case 7:
+                        if (otherSlot)
+                        {
+                            otherSlot.shareAcrossThreads();
+
+                            const std::lock_guard<std::mutex> lock{mailbox.mutex};
+                            mailbox.slots[sharedObjectIndex] = otherSlot;
+                        }
+                        break;
+
+                    case 8:
+                    {
+                        const std::lock_guard<std::mutex> lock{mailbox.mutex};
+                        slot = mailbox.slots[sharedObjectIndex];
+                        break;
+                    }
+
+                    default:
+                        slot = SharedPtr<Object>{};
+                        break;
+                }
+            }
+            catch (const std::exception& exception)
+            {
+                if (threadState.failures.empty())
+                {
+                    threadState.failures.push_back("round " + std::to_string(roundIndex) + ": " + exception.what());
+                }
+
+                continue;
+            }
+
+            if (!slot)
+            {
+                continue;
+            }
+
+            // other threads come and go, but the holders seen from here stay. the local
+            // holders of migrated data share one reference in the target table, so only
+            // they see the full count
+            //
+            std::size_t heldCount = 0;
+            std::size_t useCount = 0;
+            for (const auto& otherSlot : slots)
+            {
+                if (otherSlot && &*otherSlot == &*slot)
+                {
+                    ++heldCount;
+                    useCount = std::max(useCount, otherSlot.getUseCount());
+                }
+            }
+
+            for (const auto& sharedObject : sharedObjects)
+            {
+                heldCount += &*sharedObject == &*slot;
+            }
+
+            // only the first failure of a thread is kept, but it keeps going so that the
+            // lockstep barrier does not wait for it forever
+            //
+            if ((useCount < heldCount || slot->magic.load(std::memory_order_relaxed) != Object::AliveMagic)
+                && threadState.failures.empty())
+            {
+                threadState.failures.push_back("round " + std::to_string(roundIndex) + ": an object held "
+                                               + std::to_string(heldCount) + " times from one thread has count "
+                                               + std::to_string(useCount));
+            }
+        }
+
+        // the thread-local table goes away with this thread, so every holder left in it
+        // moves out, which must leave it empty
+        //
+        if (isMigrating)
+        {
+            for (auto& slot : slots)
+            {
+                slot.shareAcrossThreads();
+            }
+
+            const auto localCount = SharedPtrDataManagementTable::GetThreadLocalInstance().getStats().liveCount;
+            if (localCount && threadState.failures.empty())
+            {
+                threadState.failures.push_back("round " + std::to_string(roundIndex) + ": "
+                                               + std::to_string(localCount) + " thread-local entries left behind");
+            }
+        }
+    }
+
+    static void checkQuiescentState(const std::vector<SharedPtr<Object>>& sharedObjects,
+                                    const Mailbox& mailbox,
+                                    std::vector<ThreadState>& threadStates,
+                                    const Counters& counters,
+                                    std::size_t roundIndex,
+                                    std::vector<std::string>& failures)
+    {
+        std::unordered_map<const Object*, std::pair<SharedPtr<Object>, std::size_t>> heldCounts;
+        for (const auto& sharedObject : sharedObjects)
+        {
+            auto& heldCount = heldCounts[&*sharedObject];
+            heldCount.first = sharedObject;
+            ++heldCount.second;
+        }
+
+        const auto countHolder = [&heldCounts](const SharedPtr<Object>& slot)
+        {
+            if (slot)
+            {
+                auto& heldCount = heldCounts[&*slot];
+                heldCount.first = slot;
+                ++heldCount.second;
+            }
+        };
+
+        for (const auto& threadState : threadStates)
+        {
+            std::for_each(threadState.slots.begin(), threadState.slots.end(), countHolder);
+        }
+
+        std::for_each(mailbox.slots.begin(), mailbox.slots.end(), countHolder);
+
+        const auto roundName = "round " + std::to_string(roundIndex) + ": ";
+        for (const auto& [object, heldCount] : heldCounts)
+        {
+            // the copy in heldCount holds it once more
+            //
+            const auto useCount = heldCount.first.getUseCount();
+            if (useCount != heldCount.second + 1)
+            {
+                failures.push_back(roundName + "an object held " + std::to_string(heldCount.second)
+                                   + " times has count " + std::to_string(useCount - 1));
+            }
+
+            if (object->magic.load(std::memory_order_relaxed) != Object::AliveMagic)
+            {
+                failures.push_back(roundName + "a held object was deleted");
+            }
+        }
+
+        const auto aliveCount = counters.createdCount - counters.destroyedCount;
+        if (aliveCount != heldCounts.size())
+        {
+            failures.push_back(roundName + std::to_string(aliveCount) + " objects alive but "
+                               + std::to_string(heldCounts.size()) + " held");
+        }
+    }
+};
+
+
+#if SHAREDPTR_HAS_COROUTINES
+
+// size-classed free lists for coroutine frames, one set per thread so that neither
+// allocating nor freeing a frame synchronizes. a frame freed on another thread simply
+// joins that thread's lists. frames too large for the biggest class go to the heap
+// directly. a memory pressure trim makes every thread drop its cached frames the next
+// time it allocates or frees one
+//
+class SharedPtrFramePool
+{
+public:
+    static void* Allocate(std::size_t size)
+    {
+        const auto sizeClass = getSizeClass(size);
+        if (sizeClass == SizeClassCount)
+        {
+            GetHeapAllocationCount().fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        auto& threadPool = GetThreadPool();
+        threadPool.applyTrim();
+
+        if (auto* frame = threadPool.freeFrames[sizeClass])
+        {
+            threadPool.freeFrames[sizeClass] = frame->next;
+            --threadPool.freeFrameCounts[sizeClass];
+            return frame;
+        }
+
+        GetHeapAllocationCount().fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(MinFrameSize << sizeClass);
+    }
+
+    static void Deallocate(void* frame, std::size_t size) noexcept
+    {
+        const auto sizeClass = getSizeClass(size);
+        if (sizeClass == SizeClassCount)
+        {
+            ::operator delete(frame);
+            return;
+        }
+
+        auto& threadPool = GetThreadPool();
+        threadPool.applyTrim();
+
+        if (threadPool.freeFrameCounts[sizeClass] >= SharedPtrConfig::Get().framePoolSize)
+        {
+            ::operator delete(frame);
+            return;
+        }
+
+        threadPool.freeFrames[sizeClass] = new (frame) FreeFrame{threadPool.freeFrames[sizeClass]};
+        ++threadPool.freeFrameCounts[sizeClass];
+    }
+
+    // how many frames could not be served from the pools, over the whole process
+    //
+    static std::size_t GetHeapAllocationCountValue()
+    {
+        return GetHeapAllocationCount().load(std::memory_order_relaxed);
+    }
+
+    static void Trim()
+    {
+        GetTrimEpoch().fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr std::size_t MinFrameSize{64};
+    static constexpr std::size_t SizeClassCount{8};
+
+    struct FreeFrame
+    {
+        FreeFrame* next;
+    };
+
+    struct ThreadPool
+    {
+        std::array<FreeFrame*, SizeClassCount> freeFrames{};
+        std::array<std::size_t, SizeClassCount> freeFrameCounts{};
+        std::uint64_t trimEpoch{GetTrimEpoch().load(std::memory_order_relaxed)};
+
+        ThreadPool()
+        {
+            static const auto pressureListenerId = SharedPtrMemoryPressure::AddListener(&SharedPtrFramePool::Trim);
+            static_cast<void>(pressureListenerId);
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool()
+        {
+            releaseFrames();
+        }
+
+        void applyTrim()
+        {
+            const auto currentTrimEpoch = GetTrimEpoch().load(std::memory_order_relaxed);
+            if (trimEpoch != currentTrimEpoch)
+            {
+                trimEpoch = currentTrimEpoch;
+                releaseFrames();
+            }
+        }
+
+        void releaseFrames()
+        {
+            for (std::size_t sizeClass{0}; sizeClass < SizeClassCount; ++sizeClass)
+            {
+                while (auto* frame = freeFrames[sizeClass])
+                {
+                    freeFrames[sizeClass] = frame->next;
+                    ::operator delete(frame);
+                }
+
+                freeFrameCounts[sizeClass] = 0;
+            }
+        }
+    };
+
+    static ThreadPool& GetThreadPool()
+    {
+        thread_local ThreadPool threadPool;
+        return threadPool;
+    }
+
+    static std::atomic<std::uint64_t>& GetTrimEpoch()
+    {
+        static std::atomic<std::uint64_t> trimEpoch{0};
+        return trimEpoch;
+    }
+
+    static std::atomic_size_t& GetHeapAllocationCount()
+    {
+        static std::atomic_size_t heapAllocationCount{0};
+        return heapAllocationCount;
+    }
+
+    static std::size_t getSizeClass(std::size_t size)
+    {
+        std::size_t sizeClass{0};
+        while ((sizeClass < SizeClassCount) && ((MinFrameSize << sizeClass) < size))
+        {
+            ++sizeClass;
+        }
+
+        return sizeClass;
+    }
+};
+
+
+template <typename ResultT>
+class Task;
+
+// what a Task produces: values are kept in a block of their own straight away, the way
+// MakeSharedPtr() creates them, so awaiting one only hands out a SharedPtr to it
+//
+template <typename ResultT>
+class TaskPromiseResult
+{
 public:
+    template <typename ValueT>
+    void return_value(ValueT&& value)
+    {
+        m_result = MakeSharedPtr<ResultT>(std::forward<ValueT>(value));
+    }
+
+protected:
+    SharedPtr<ResultT> m_result;
+
+    SharedPtr<ResultT> takeResult()
+    {
+        return std::move(m_result);
+    }
+};
+
+template <>
+class TaskPromiseResult<void>
+{
+public:
+    void return_void()
+    {
+
+    }
+
+protected:
+    void takeResult()
+    {
+
+    }
+};
+
+// a lazily started coroutine, which runs when awaited and resumes its awaiter right when
+// it finishes, by symmetric transfer, so a chain of co_awaits allocates nothing but the
+// pooled frames and the results
+//
+template <typename ResultT>
+class Task
+{
+public:
+    class promise_type : public TaskPromiseResult<ResultT>
+    {
+    public:
+        static void* operator new(std::size_t size)
+        {
+            return SharedPtrFramePool::Allocate(size);
+        }
+
+        static void operator delete(void* frame, std::size_t size) noexcept
+        {
+            SharedPtrFramePool::Deallocate(frame, size);
+        }
+
+        Task get_return_object() noexcept
+        {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    const auto continuation = handle.promise().m_continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept
+                {
+
+                }
+            };
+
+            return FinalAwaiter{};
+        }
+
+        void unhandled_exception() noexcept
+        {
+            m_exception = std::current_exception();
+        }
+
+    private:
+        std::coroutine_handle<> m_continuation;
+        std::exception_ptr m_exception;
+
+        friend class Task;
+    };
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept
+    : m_handle{std::exchange(other.m_handle, {})}
+    {
+
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+
+        return *this;
+    }
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return m_handle.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        m_handle.promise().m_continuation = continuation;
+        return m_handle;
+    }
+
+    auto await_resume()
+    {
+        return takeResult();
+    }
+
+    // runs the task to completion from code which is not a coroutine itself, which only
+    // works as long as nothing but other Tasks suspends it
+    //
+    auto get()
+    {
+        if (!m_handle.done())
+        {
+            m_handle.resume();
+        }
+
+        if (!m_handle.done())
+        {
+            throw std::logic_error{"Task::get called on a task suspended by something else than a Task"};
+        }
+
+        return takeResult();
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+    : m_handle{handle}
+    {
+
+    }
+
+    auto takeResult()
+    {
+        auto& promise = m_handle.promise();
+        if (promise.m_exception)
+        {
+            std::rethrow_exception(promise.m_exception);
+        }
+
+        return promise.takeResult();
+    }
+
+    void destroy()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+};
+
+#endif
+
+
+class Base
+{
+public:
+    using SharedPtrFamilyRoot = Base;
+
     explicit Base(std::string description)
     : m_data{new int{10}},
       m_instanceIndex{++m_classIndex},
@@ -310,79 +5779,373 @@ public:
     {
         delete m_data;
 
-        --m_aliveInstanceCount;
+        --m_aliveInstanceCount;
+
+        std::cout << "Base::~Base(): instance #" << m_instanceIndex 
+                  << " destroyed...\n" << std::flush;
+    }
+
+    virtual void showDescription() const
+    {
+        std::cout << "instance #" << m_instanceIndex 
+                  << " with description = " << m_description << "\n" << std::flush;
+    }
+
+    static int getCountOfAliveInstances()
+    {
+        return m_aliveInstanceCount;
+    }
+
+private:
+    static int m_aliveInstanceCount;
+    static int m_classIndex;
+
+    const int* m_data;
+    const int m_instanceIndex;
+    const std::string m_description;
+};
+
+
+int Base::m_aliveInstanceCount{};
+int Base::m_classIndex{};
+
+
+class Derived : public Base
+{
+public:
+    explicit Derived(std::string description)
+    : Base{std::move(description)},
+      m_otherData{new double{10.5}}
+    {
+        std::cout << "Derived::Derived()\n" << std::flush;
+    }
+
+    Derived(const Derived&) = delete;
+    Derived& operator=(const Derived&) = delete;
+    Derived(Derived&&) = delete;
+    Derived& operator=(Derived&&) = delete;
+
+    ~Derived()
+    {
+        std::cout << "Derived::~Derived()\n" << std::flush;
+        delete m_otherData;
+    }
+
+    void showDescription() const override
+    {
+        std::cout << "from Derived: ";
+        Base::showDescription();
+    }
+
+private:
+    double* m_otherData;
+};
+
+
+class SecondBase
+{
+public:
+    SecondBase() = default;
+
+    SecondBase(const SecondBase&) = delete;
+    SecondBase& operator=(const SecondBase&) = delete;
+    SecondBase(SecondBase&&) = delete;
+    SecondBase& operator=(SecondBase&&) = delete;
+
+    virtual ~SecondBase()
+    {
+        std::cout << "SecondBase::~SecondBase()\n" << std::flush;
+    }
+
+private:
+    const long m_secondData{20};
+};
+
+
+class MultiDerived : public Derived, public SecondBase
+{
+public:
+    explicit MultiDerived(std::string description)
+    : Derived{std::move(description)}
+    {
+        std::cout << "MultiDerived::MultiDerived()\n" << std::flush;
+    }
+
+    ~MultiDerived()
+    {
+        std::cout << "MultiDerived::~MultiDerived()\n" << std::flush;
+    }
+};
+
+
+struct GraphNode
+{
+    int value;
+    SharedPtr<GraphNode> left;
+    SharedPtr<GraphNode> right;
+};
+
+
+struct FrozenGraphNode
+{
+    int value;
+    FrozenRef<FrozenGraphNode> left;
+    FrozenRef<FrozenGraphNode> right;
+};
+
+
+template <>
+struct SharedPtrFreezeTraits<GraphNode>
+{
+    using Frozen = FrozenGraphNode;
+
+    template <typename VisitorT>
+    static void Trace(const GraphNode& node, VisitorT&& visit)
+    {
+        visit(node.left);
+        visit(node.right);
+    }
+
+    static void Freeze(const GraphNode& node, FrozenGraphNode& frozenNode, SharedPtrFreezer& freezer)
+    {
+        frozenNode.value = node.value;
+        freezer.link(frozenNode.left, node.left);
+        freezer.link(frozenNode.right, node.right);
+    }
+};
+
+
+#if defined(SHAREDPTR_LIFECYCLE_LISTENER)
+class CountingLifecycleListener : public SharedPtrLifecycleListener
+{
+public:
+    explicit CountingLifecycleListener(const SharedPtrDataManagementTable& table)
+    : m_table{table}
+    {
+
+    }
+
+    std::size_t adoptCount{0};
+    std::size_t copyCount{0};
+    std::size_t releaseCount{0};
+    std::size_t deleteCount{0};
+
+    void onAdopt(const SharedPtrDataManagementTable& table, const void*) override
+    {
+        adoptCount += &table == &m_table;
+    }
+
+    void onCopy(const SharedPtrDataManagementTable& table, const void*) override
+    {
+        copyCount += &table == &m_table;
+    }
+
+    void onRelease(const SharedPtrDataManagementTable& table, const void*) override
+    {
+        releaseCount += &table == &m_table;
+    }
+
+    void onDelete(const SharedPtrDataManagementTable& table, const void*) override
+    {
+        deleteCount += &table == &m_table;
+    }
+
+private:
+    const SharedPtrDataManagementTable& m_table;
+};
+#endif
+
+
+#if SHAREDPTR_HAS_COROUTINES
+Task<int> computeAnswer(int answer)
+{
+    co_return answer;
+}
+
+
+Task<int> addAnswers()
+{
+    auto firstAnswer = co_await computeAnswer(20);
+    auto secondAnswer = co_await computeAnswer(22);
+    co_return *firstAnswer + *secondAnswer;
+}
+#endif
+
+
+// runs every schedule against a few differently configured tables, printing the
+// throughput of each, and fails if any of them broke
+//
+int runTortureTests()
+{
+    SharedPtrDomainPolicy singleShardPolicy{};
+    singleShardPolicy.shardCount = 1;
+
+    const std::pair<const char*, SharedPtrDataManagementTable*> tables[]
+    {
+        {"default", &SharedPtrDataManagementTable::GetInstance()},
+        {"single shard", &SharedPtrDataManagementTable::GetDomain("torture:single shard", singleShardPolicy)},
+        {"family", &SharedPtrDataManagementTable::GetFamilyInstance<Base>()}
+    };
+
+    auto passed = true;
+    for (const auto& [tableName, table] : tables)
+    {
+        for (const auto schedule : {SharedPtrTortureTest::Schedule::Free,
+                                    SharedPtrTortureTest::Schedule::Yielding,
+                                    SharedPtrTortureTest::Schedule::Lockstep,
+                                    SharedPtrTortureTest::Schedule::Migrating})
+        {
+            SharedPtrTortureTest::Options options{};
+            options.schedule = schedule;
+            options.threadCount = std::max(2u, std::thread::hardware_concurrency());
+            options.roundCount = 32;
+            options.operationsPerRound = schedule == SharedPtrTortureTest::Schedule::Lockstep ? 2000 : 20000;
+
+            const auto result = SharedPtrTortureTest::Run(*table, options);
+            std::cout << tableName << " table, " << SharedPtrTortureTest::GetScheduleName(schedule) << " schedule: "
+                      << static_cast<std::size_t>(result.getOperationsPerSecond()) << " operations/s, "
+                      << (result.passed() ? "passed" : "FAILED") << std::endl;
+
+            for (const auto& failure : result.failures)
+            {
+                std::cout << "    " << failure << std::endl;
+            }
+
+            passed = passed && result.passed();
+        }
+    }
+
+    return passed ? 0 : 1;
+}
+
+
+// a producer thread adopts objects in batches which a consumer thread releases, in a
+// domain deleting them on the consumer right away, in one returning them to the producer
+// and in one deferring their deletion on the consumer, printing the throughput of each.
+// remote frees only cost anything with the two threads on different cores
+//
+int runPipelineBenchmark()
+{
+    constexpr std::size_t BatchCount{4000};
+    constexpr std::size_t BatchSize{256};
+
+    using Object = std::array<std::uint64_t, 8>;
+    using Batch = std::vector<SharedPtr<Object>>;
 
-        std::cout << "Base::~Base(): instance #" << m_instanceIndex 
-                  << " destroyed...\n" << std::flush;
-    }
+    SharedPtrDomainPolicy returningPolicy{};
+    returningPolicy.returnToCreatorThread = true;
 
-    virtual void showDescription() const
+    SharedPtrDomainPolicy deferringPolicy{};
+    deferringPolicy.deferDeletion = true;
+
+    const std::pair<const char*, SharedPtrDomainPolicy> modes[]
     {
-        std::cout << "instance #" << m_instanceIndex 
-                  << " with description = " << m_description << "\n" << std::flush;
-    }
+        {"deleting on the consumer", SharedPtrDomainPolicy{}},
+        {"returning to the creator thread", returningPolicy},
+        {"deferring on the consumer", deferringPolicy}
+    };
 
-    static int getCountOfAliveInstances()
+    for (const auto& [modeName, policy] : modes)
     {
-        return m_aliveInstanceCount;
-    }
+        auto& domain = SharedPtrDataManagementTable::GetDomain(std::string{"pipeline:"} + modeName, policy);
 
-private:
-    static int m_aliveInstanceCount;
-    static int m_classIndex;
+        std::mutex mutex;
+        std::condition_variable batchAdded;
+        std::deque<Batch> batches;
+        auto isDone = false;
 
-    const int* m_data;
-    const int m_instanceIndex;
-    const std::string m_description;
-};
+        const auto startTime = std::chrono::steady_clock::now();
 
+        std::thread consumer{[&]()
+        {
+            for (;;)
+            {
+                Batch batch;
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    batchAdded.wait(lock, [&]()
+                    {
+                        return isDone || !batches.empty();
+                    });
 
-int Base::m_aliveInstanceCount{};
-int Base::m_classIndex{};
+                    if (batches.empty())
+                    {
+                        SharedPtrDataManagementTable::FlushDeferredDeletions();
+                        return;
+                    }
 
+                    batch = std::move(batches.front());
+                    batches.pop_front();
+                }
 
-class Derived : public Base
-{
-public:
-    explicit Derived(std::string description)
-    : Base{std::move(description)},
-      m_otherData{new double{10.5}}
-    {
-        std::cout << "Derived::Derived()\n" << std::flush;
+                batch.clear();
+            }
+        }};
+
+        for (std::size_t batchIndex{0}; batchIndex < BatchCount; ++batchIndex)
+        {
+            Batch batch;
+            batch.reserve(BatchSize);
+            for (std::size_t objectIndex{0}; objectIndex < BatchSize; ++objectIndex)
+            {
+                batch.emplace_back(MakeSharedPtrInDomain<Object>(domain));
+            }
+
+            {
+                const std::lock_guard<std::mutex> lock{mutex};
+                batches.push_back(std::move(batch));
+            }
+
+            batchAdded.notify_one();
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock{mutex};
+            isDone = true;
+        }
+
+        batchAdded.notify_one();
+        consumer.join();
+        SharedPtrDataManagementTable::DrainCreatorInbox();
+
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << modeName << ": " << static_cast<std::size_t>(BatchCount * BatchSize / seconds) << " objects/s"
+                  << std::endl;
+
+        if (domain.getStats().liveCount)
+        {
+            std::cout << "    " << domain.getStats().liveCount << " objects left behind" << std::endl;
+            return 1;
+        }
     }
 
-    Derived(const Derived&) = delete;
-    Derived& operator=(const Derived&) = delete;
-    Derived(Derived&&) = delete;
-    Derived& operator=(Derived&&) = delete;
+    return 0;
+}
 
-    ~Derived()
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string{argv[1]} == "--torture")
     {
-        std::cout << "Derived::~Derived()\n" << std::flush;
-        delete m_otherData;
+        return runTortureTests();
     }
 
-    void showDescription() const override
+    if (argc > 1 && std::string{argv[1]} == "--pipeline")
     {
-        std::cout << "from Derived: ";
-        Base::showDescription();
+        return runPipelineBenchmark();
     }
 
-private:
-    double* m_otherData;
-};
-
-
-int main()
-{
     {
-        auto baseSharedPtr = MakeSharedPtr<Base>("base type, instance # should be 1");
+        SharedPtr<Base> baseSharedPtr = MakeSharedPtr<Base>("base type, instance # should be 1");
         assert(baseSharedPtr);
         baseSharedPtr->showDescription();
         std::cout << std::endl;
 
-        auto derivedSharedPtr = MakeSharedPtr<Derived>("derived type, instance # should be 2");
+        SharedPtr<Derived> derivedSharedPtr = MakeSharedPtr<Derived>("derived type, instance # should be 2");
         assert(derivedSharedPtr);
+        assert(&SharedPtrDomainOf<Derived>::Get() == &SharedPtrDataManagementTable::GetFamilyInstance<Base>());
+        assert(2 == SharedPtrDataManagementTable::GetFamilyInstance<Base>().getStats().liveCount);
+        assert(0 == SharedPtrDataManagementTable::GetInstance().getStats().liveCount);
         derivedSharedPtr->showDescription();
         std::cout << std::endl;
 
@@ -450,5 +6213,548 @@ int main()
 
     assert(0 == Base::getCountOfAliveInstances());
 
+    std::cout << std::endl;
+    {
+        auto notNullSharedPtr = MakeSharedPtr<Derived>("not null derived type, instance # should be 4");
+        notNullSharedPtr->showDescription();
+
+        SharedPtr<Base> baseSharedPtr{notNullSharedPtr};
+        assert(2 == notNullSharedPtr.getUseCount());
+
+        auto notNullBaseSharedPtr = AsNotNullSharedPtr(baseSharedPtr);
+        assert(3 == notNullBaseSharedPtr.getUseCount());
+        notNullBaseSharedPtr->showDescription();
+
+        SharedPtr<Base> lastBaseSharedPtr = std::move(notNullBaseSharedPtr);
+        assert(3 == lastBaseSharedPtr.getUseCount());
+
+        baseSharedPtr.release();
+
+        [[maybe_unused]] bool threw{false};
+        try
+        {
+            AsNotNullSharedPtr(baseSharedPtr);
+        }
+        catch (const std::logic_error&)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    std::cout << std::endl;
+    {
+        auto& cacheDomain = SharedPtrDataManagementTable::GetDomain("cache");
+        assert(&cacheDomain == &SharedPtrDataManagementTable::GetDomain("cache"));
+        assert(&cacheDomain != &SharedPtrDataManagementTable::GetInstance());
+
+        auto cachedSharedPtr = MakeSharedPtrInDomain<Derived>(cacheDomain,
+                                                              "cached derived type, instance # should be 5");
+        SharedPtr<Base> cachedBaseSharedPtr{cachedSharedPtr};
+        auto* cachedData = &*cachedBaseSharedPtr;
+        assert(2 == cachedBaseSharedPtr.getUseCount());
+        assert(1 == cacheDomain.getStats().liveCount);
+
+        std::size_t liveDataCount{0};
+        cacheDomain.forEachLive([&liveDataCount, cachedData]([[maybe_unused]] void* data,
+                                                             [[maybe_unused]] std::size_t count)
+        {
+            assert(static_cast<void*>(cachedData) == data);
+            assert(2 == count);
+            ++liveDataCount;
+        });
+        assert(1 == liveDataCount);
+        assert(0 == SharedPtrDataManagementTable::GetInstance().getCount(cachedData));
+
+        auto uncachedSharedPtr = MakeSharedPtr<Base>("uncached base type, instance # should be 6");
+        assert(IsSharedPtrManaged(&*uncachedSharedPtr));
+        assert(!IsSharedPtrManaged(cachedData));
+        assert(cacheDomain.isManaged(cachedData));
+
+        auto adoptedSharedPtr = SharedPtr<Base>::TryAdopt(&*uncachedSharedPtr);
+        assert(adoptedSharedPtr);
+        assert(2 == uncachedSharedPtr.getUseCount());
+
+        // enough holders to spill the count out of its packed entry and back
+        //
+        {
+            std::vector<SharedPtr<Base>> manyHolders(0x10000, adoptedSharedPtr);
+            assert(0x10002 == uncachedSharedPtr.getUseCount());
+        }
+        assert(2 == uncachedSharedPtr.getUseCount());
+
+        // only the cache domain gets torn down, the holders above just let go of its entry
+        //
+        [[maybe_unused]] const auto destroyedCount = cacheDomain.destroyAllData();
+        assert(1 == destroyedCount);
+        assert(1 == Base::getCountOfAliveInstances());
+        assert(!cacheDomain.isManaged(static_cast<void*>(cachedData)));
+        [[maybe_unused]] const auto readopted = cacheDomain.addDataIfManaged(static_cast<void*>(cachedData));
+        assert(!readopted);
+
+        [[maybe_unused]] int notManagedData{};
+        assert(!IsSharedPtrManaged(&notManagedData));
+        assert(!SharedPtr<int>::TryAdopt(&notManagedData));
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    std::cout << std::endl;
+    {
+        auto localSharedPtr = MakeSharedPtrInDomain<Base>(SharedPtrDataManagementTable::GetThreadLocalInstance(),
+                                                          "thread-local base type, instance # should be 7");
+
+        SharedPtr<Base> sharedAcrossThreads{localSharedPtr};
+        sharedAcrossThreads.shareAcrossThreads();
+        assert(2 == localSharedPtr.getUseCount());
+        assert(2 == sharedAcrossThreads.getUseCount());
+
+        bool threw{false};
+        std::thread{[&]()
+        {
+            SharedPtr<Base> otherThreadSharedPtr{sharedAcrossThreads};
+            assert(3 == otherThreadSharedPtr.getUseCount());
+            otherThreadSharedPtr->showDescription();
+
+            // the data moved to the family table of Base, where adopting it again finds it
+            //
+            {
+                SharedPtr<Base> adoptedSharedPtr{&*otherThreadSharedPtr};
+                assert(4 == otherThreadSharedPtr.getUseCount());
+            }
+
+            try
+            {
+                SharedPtr<Base> notSharedAcrossThreads{localSharedPtr};
+            }
+            catch (const std::logic_error&)
+            {
+                threw = true;
+            }
+        }}.join();
+        assert(threw);
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    std::cout << std::endl;
+    {
+        auto multiDerivedSharedPtr = MakeSharedPtr<MultiDerived>("multi derived type, instance # should be 8");
+
+        // the SecondBase subobject does not live at the address of the object, yet both
+        // SharedPtrs share a single entry
+        //
+        SharedPtr<SecondBase> secondBaseSharedPtr{multiDerivedSharedPtr};
+        assert(static_cast<void*>(&*secondBaseSharedPtr) != static_cast<void*>(&*multiDerivedSharedPtr));
+        assert(2 == secondBaseSharedPtr.getUseCount());
+
+        // SecondBase is not part of the family of Base, but the data still is
+        //
+        auto adoptedSecondBaseSharedPtr = SharedPtr<SecondBase>::TryAdopt(&*secondBaseSharedPtr);
+        assert(adoptedSecondBaseSharedPtr);
+        assert(3 == multiDerivedSharedPtr.getUseCount());
+        assert(IsSharedPtrManaged(&*secondBaseSharedPtr));
+
+        {
+            SharedPtr<SecondBase> plainlyAdoptedSharedPtr{&*secondBaseSharedPtr};
+            assert(4 == multiDerivedSharedPtr.getUseCount());
+        }
+        assert(3 == multiDerivedSharedPtr.getUseCount());
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    std::cout << std::endl;
+    {
+        // adopted through the SecondBase subobject, so that is also what it gets deleted through
+        //
+        SharedPtr<SecondBase> secondBaseSharedPtr{new MultiDerived{"multi derived type, instance # should be 9"}};
+
+        SharedPtr<Base> baseSharedPtr{secondBaseSharedPtr};
+        assert(baseSharedPtr);
+        assert(2 == baseSharedPtr.getUseCount());
+
+        secondBaseSharedPtr = SharedPtr<SecondBase>{};
+        baseSharedPtr->showDescription();
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    {
+        auto& scratchDomain = SharedPtrDataManagementTable::GetDomain("scratch");
+
+        std::vector<SharedPtr<int>> scratchSharedPtrs;
+        for (int value{0}; value < 10000; ++value)
+        {
+            scratchSharedPtrs.emplace_back(new int{value}, scratchDomain);
+        }
+
+        auto retainedSharedPtr = scratchSharedPtrs.back();
+        const auto listenerId = SharedPtrMemoryPressure::AddListener([&scratchSharedPtrs]()
+        {
+            scratchSharedPtrs.clear();
+        });
+
+        [[maybe_unused]] const auto trimmedCount = SharedPtrMemoryPressure::Trim();
+        assert(0 < trimmedCount);
+        assert(scratchSharedPtrs.empty());
+        assert(1 == scratchDomain.getStats().liveCount);
+        assert(1 == retainedSharedPtr.getUseCount());
+
+        SharedPtrMemoryPressure::RemoveListener(listenerId);
+        SharedPtrMemoryPressure::StartMonitor(100, std::chrono::milliseconds{1});
+        std::this_thread::sleep_for(std::chrono::milliseconds{5});
+        SharedPtrMemoryPressure::StopMonitor();
+    }
+
+    {
+        VersionedCell<std::string> versionedCell{MakeSharedPtr<std::string>("first")};
+
+        auto firstSnapshot = std::make_unique<SharedPtrSnapshot>();
+        versionedCell.write(MakeSharedPtr<std::string>("second"));
+        {
+            const SharedPtrSnapshot secondSnapshot;
+            versionedCell.write(MakeSharedPtr<std::string>("third"));
+
+            assert("first" == *versionedCell.read(*firstSnapshot));
+            assert("second" == *versionedCell.read(secondSnapshot));
+            assert("third" == *versionedCell.read(SharedPtrSnapshot{}));
+            assert(3 == versionedCell.getVersionCount());
+        }
+
+        // the first snapshot still sees the first version, so everything in between stays
+        //
+        versionedCell.pruneVersions();
+        assert(3 == versionedCell.getVersionCount());
+
+        auto firstValue = versionedCell.readShared(*firstSnapshot);
+        firstSnapshot.reset();
+        versionedCell.pruneVersions();
+        assert(1 == versionedCell.getVersionCount());
+        assert("first" == *firstValue);
+    }
+
+    {
+        struct FreeDeleter
+        {
+            void operator()(int* data) const
+            {
+                std::free(data);
+            }
+        };
+
+        auto* mallocData = static_cast<int*>(std::malloc(sizeof(int)));
+        SharedPtr<int> mallocSharedPtr{mallocData, FreeDeleter{}};
+        SharedPtr<int> anotherMallocSharedPtr{mallocSharedPtr};
+        assert(2 == anotherMallocSharedPtr.getUseCount());
+
+        std::size_t closedHandleCount{0};
+        {
+            SharedResource<int> handle{7, [&closedHandleCount]([[maybe_unused]] int handleValue)
+            {
+                assert(7 == handleValue);
+                ++closedHandleCount;
+            }};
+            SharedResource<int> anotherHandle{handle};
+            assert(2 == anotherHandle.getUseCount());
+            assert(7 == anotherHandle.get());
+        }
+        assert(1 == closedHandleCount);
+
+        SharedResource<std::FILE*> file{std::tmpfile(), [](std::FILE* openFile)
+        {
+            std::fclose(openFile);
+        }};
+        assert(file);
+        assert(1 == file.getUseCount());
+    }
+
+    {
+        // the chunks filled by the earlier rounds get reused by the later ones
+        //
+        for (int round{0}; round < 4; ++round)
+        {
+            std::vector<SharedPtr<long>> nurserySharedPtrs;
+            for (long value{0}; value < 20000; ++value)
+            {
+                nurserySharedPtrs.emplace_back(MakeSharedPtrInNursery<long>(value));
+            }
+
+            assert(19999 == *nurserySharedPtrs.back());
+        }
+
+        [[maybe_unused]] const auto nurseryStats = SharedPtrNursery::GetStats();
+        assert(0 < nurseryStats.recycledChunkCount);
+
+        // without a reserve, which is the default, the hint does nothing and children go
+        // wherever the nursery allocates next
+        //
+        if (0 == SharedPtrConfig::Get().nurseryNearReserveSize)
+        {
+            auto unhintedParentNode = MakeSharedPtrInNursery<long>(0);
+            std::vector<SharedPtr<long>> unhintedSharedPtrs;
+            for (long value{0}; value < 5000; ++value)
+            {
+                unhintedSharedPtrs.emplace_back(MakeSharedPtrInNursery<long>(value));
+            }
+
+            [[maybe_unused]] auto unhintedChildNode = MakeSharedPtrNear<long>(unhintedParentNode, 1);
+            assert((reinterpret_cast<std::uintptr_t>(&*unhintedChildNode) / SharedPtrNursery::PageSize) !=
+                   (reinterpret_cast<std::uintptr_t>(&*unhintedParentNode) / SharedPtrNursery::PageSize));
+        }
+
+        // children land in the page of their parent, even once the chunk the parent is in
+        // stopped being the one new objects go to, as long as this thread reserves room for
+        // them. objects larger than a page may then still span pages
+        //
+        SharedPtrNursery::SetNearReserveSize(512);
+        auto largeNode = MakeSharedPtrInNursery<std::array<char, 3 * SharedPtrNursery::PageSize>>();
+        auto parentNode = MakeSharedPtrInNursery<long>(0);
+        std::vector<SharedPtr<long>> unrelatedSharedPtrs;
+        for (long value{0}; value < 5000; ++value)
+        {
+            unrelatedSharedPtrs.emplace_back(MakeSharedPtrInNursery<long>(value));
+        }
+
+        auto childNode = MakeSharedPtrNear<long>(parentNode, 1);
+        assert((reinterpret_cast<std::uintptr_t>(&*childNode) / SharedPtrNursery::PageSize) ==
+               (reinterpret_cast<std::uintptr_t>(&*parentNode) / SharedPtrNursery::PageSize));
+        SharedPtrNursery::SetNearReserveSize(0);
+
+        SharedPtr<Base> nurseryBase = MakeSharedPtrInNursery<Derived>("nursery derived type, instance # should be 10");
+        assert(1 == SharedPtrDataManagementTable::GetFamilyInstance<Base>().getCount(&*nurseryBase));
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    {
+        auto bulkSharedPtrs = MakeSharedPtrBulk<int>(1000, [](std::size_t index)
+        {
+            return static_cast<int>(index);
+        });
+        assert(1000 == bulkSharedPtrs.size());
+        assert(1000 == bulkSharedPtrs.front().getUseCount());
+        assert(&*bulkSharedPtrs[1] == &*bulkSharedPtrs[0] + 1);
+        assert(999 == *bulkSharedPtrs.back());
+
+        // adopting an element again joins the entry of its block
+        //
+        {
+            SharedPtr<int> adoptedElement{&*bulkSharedPtrs[1]};
+            assert(1001 == bulkSharedPtrs.front().getUseCount());
+            assert(IsSharedPtrManaged(&*bulkSharedPtrs[2]));
+
+            const auto triedElement = SharedPtr<int>::TryAdopt(&*bulkSharedPtrs[3]);
+            assert(triedElement);
+            assert(1002 == triedElement.getUseCount());
+        }
+        assert(1000 == bulkSharedPtrs.front().getUseCount());
+
+        // a single element outlives all the others, and keeps the whole block with it
+        //
+        SharedPtr<int> lastElement{bulkSharedPtrs.back()};
+        bulkSharedPtrs.clear();
+        assert(1 == lastElement.getUseCount());
+        assert(999 == *lastElement);
+
+        auto bulkBases = MakeSharedPtrBulk<Base>(2, "bulk base type, instance # should be 11 or 12");
+        assert(2 == Base::getCountOfAliveInstances());
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+
+    {
+        // a diamond, whose shared node is frozen once
+        //
+        SharedPtr<GraphNode> sharedNode = MakeSharedPtr<GraphNode>(GraphNode{3, {}, {}});
+        SharedPtr<GraphNode> rootNode = MakeSharedPtr<GraphNode>(
+                                            GraphNode{0,
+                                                      MakeSharedPtr<GraphNode>(GraphNode{1, {}, sharedNode}),
+                                                      MakeSharedPtr<GraphNode>(GraphNode{2, sharedNode, {}})});
+
+        auto frozenRoot = Freeze(rootNode);
+        rootNode = SharedPtr<GraphNode>{};
+        sharedNode = SharedPtr<GraphNode>{};
+
+        assert(0 == frozenRoot->value);
+        assert(1 == frozenRoot->left->value);
+        assert(2 == frozenRoot->right->value);
+        assert(3 == frozenRoot->left->right->value);
+        assert(frozenRoot->left->right.get() == frozenRoot->right->left.get());
+        assert(!frozenRoot->left->left);
+        assert(1 == frozenRoot.getUseCount());
+    }
+
+    {
+        SharedPtr<std::string> publishedSetting = MakeSharedPtr<std::string>("published");
+        {
+            GlobalShared<std::string> globalSetting{MakeSharedPtr<std::string>("initial")};
+
+            [[maybe_unused]] const auto& cachedSetting = globalSetting.get();
+            assert(&cachedSetting == &globalSetting.get());
+            assert(2 == cachedSetting.getUseCount());
+
+            globalSetting.publish(publishedSetting);
+            assert("initial" == *cachedSetting);
+            std::thread{[&globalSetting]()
+            {
+                assert("published" == *globalSetting.get());
+            }}.join();
+
+            assert("published" == *globalSetting.get());
+            assert(3 == globalSetting.get().getUseCount());
+        }
+
+        // the copy this thread kept went away with the GlobalShared, whose id the next one reuses
+        //
+        assert(1 == publishedSetting.getUseCount());
+
+        GlobalShared<std::string> nextGlobalSetting{MakeSharedPtr<std::string>("next")};
+        assert("next" == *nextGlobalSetting.get());
+    }
+
+    {
+        SharedPtrDomainPolicy returningPolicy{};
+        returningPolicy.returnToCreatorThread = true;
+        auto& returningDomain = SharedPtrDataManagementTable::GetDomain("returning", returningPolicy);
+
+        // the consumer drops the last holders, but the data gets deleted back here, except
+        // for data with a deleter of its own
+        //
+        std::size_t customDeletedCount{0};
+        SharedPtr<int> customDeletedInt{new int{1},
+                                        [&customDeletedCount](int* data)
+                                        {
+                                            delete data;
+                                            ++customDeletedCount;
+                                        },
+                                        returningDomain};
+
+        std::vector<SharedPtr<Base>> producedSharedPtrs;
+        producedSharedPtrs.emplace_back(MakeSharedPtrInDomain<Base>(returningDomain,
+                                                                    "returned base type, instance # should be 13"));
+        producedSharedPtrs.emplace_back(MakeSharedPtrInDomain<Base>(returningDomain,
+                                                                    "returned base type, instance # should be 14"));
+
+        std::thread{[consumedSharedPtrs = std::move(producedSharedPtrs),
+                     consumedInt = std::move(customDeletedInt)]() mutable
+        {
+            consumedSharedPtrs.clear();
+            consumedInt = SharedPtr<int>{};
+        }}.join();
+
+        assert(1 == customDeletedCount);
+        assert(2 == Base::getCountOfAliveInstances());
+        [[maybe_unused]] const auto returnedCount = SharedPtrDataManagementTable::DrainCreatorInbox();
+        assert(2 == returnedCount);
+        assert(0 == Base::getCountOfAliveInstances());
+    }
+
+    {
+        SharedPtrDomainPolicy deferringPolicy{};
+        deferringPolicy.deferDeletion = true;
+        auto& deferringDomain = SharedPtrDataManagementTable::GetDomain("deferring", deferringPolicy);
+
+        // the last holders leave their data behind, to be deleted grouped by type, except
+        // for data with a deleter of its own
+        //
+        std::size_t customDeletedCount{0};
+        {
+            SharedPtr<int> deferredInt = MakeSharedPtrInDomain<int>(deferringDomain, 1);
+            SharedPtr<Base> deferredBase = MakeSharedPtrInDomain<Base>(deferringDomain,
+                                                                       "deferred base type, instance # should be 15");
+            SharedPtr<int> anotherDeferredInt = MakeSharedPtrInDomain<int>(deferringDomain, 2);
+            SharedPtr<int> customDeletedInt{new int{3},
+                                            [&customDeletedCount](int* data)
+                                            {
+                                                delete data;
+                                                ++customDeletedCount;
+                                            },
+                                            deferringDomain};
+        }
+
+        assert(1 == customDeletedCount);
+        assert(1 == Base::getCountOfAliveInstances());
+        assert(0 == deferringDomain.getStats().liveCount);
+        [[maybe_unused]] const auto flushedCount = SharedPtrDataManagementTable::FlushDeferredDeletions();
+        assert(3 == flushedCount);
+        assert(0 == Base::getCountOfAliveInstances());
+    }
+
+    {
+        // a short round of every schedule; --torture runs the long ones
+        //
+        for (const auto schedule : {SharedPtrTortureTest::Schedule::Free,
+                                    SharedPtrTortureTest::Schedule::Yielding,
+                                    SharedPtrTortureTest::Schedule::Lockstep,
+                                    SharedPtrTortureTest::Schedule::Migrating})
+        {
+            SharedPtrTortureTest::Options options{};
+            options.schedule = schedule;
+            options.roundCount = 2;
+            options.operationsPerRound = 500;
+
+            [[maybe_unused]] const auto result = SharedPtrTortureTest::Run(SharedPtrDataManagementTable::GetDomain("torture"),
+                                                                           options);
+            assert(result.passed());
+        }
+    }
+
+#if SHAREDPTR_HAS_COROUTINES
+    {
+        [[maybe_unused]] const auto firstAnswer = addAnswers().get();
+        assert(42 == *firstAnswer);
+
+        // the frames of the first chain are pooled, so running it again takes no new ones
+        //
+        const auto heapAllocationCount = SharedPtrFramePool::GetHeapAllocationCountValue();
+        [[maybe_unused]] const auto secondAnswer = addAnswers().get();
+        assert(42 == *secondAnswer);
+        std::cout << "frame heap allocations per co_await chain: "
+                  << SharedPtrFramePool::GetHeapAllocationCountValue() - heapAllocationCount << std::endl;
+        assert(heapAllocationCount == SharedPtrFramePool::GetHeapAllocationCountValue());
+    }
+#endif
+
+#if defined(SHAREDPTR_LIFECYCLE_LISTENER)
+    {
+        auto& listenedDomain = SharedPtrDataManagementTable::GetDomain("listened");
+        CountingLifecycleListener listener{listenedDomain};
+        SharedPtrLifecycleListener::Install(&listener);
+
+        {
+            SharedPtr<int> adoptedSharedPtr{new int{42}, listenedDomain};
+            SharedPtr<int> copiedSharedPtr{adoptedSharedPtr};
+            SharedPtr<int> movedSharedPtr{std::move(copiedSharedPtr)};
+        }
+
+        SharedPtrLifecycleListener::Install(nullptr);
+
+        assert(1 == listener.adoptCount);
+        assert(1 == listener.copyCount);
+        assert(2 == listener.releaseCount);
+        assert(1 == listener.deleteCount);
+    }
+#endif
+
+#if defined(SHAREDPTR_TRACK_HOLDERS)
+    std::cout << std::endl;
+    {
+        auto trackedSharedPtr = MakeSharedPtr<Base>("tracked base type, instance # should be 16");
+        SharedPtr<Base> copiedSharedPtr{trackedSharedPtr};
+        SharedPtr<Base> movedSharedPtr{std::move(copiedSharedPtr)};
+
+        assert(2 == SharedPtrHolderRegistry::GetInstance().getHolders(&*trackedSharedPtr).size());
+        SharedPtrHolderRegistry::GetInstance().dumpHolders(&*trackedSharedPtr, std::cout);
+
+        movedSharedPtr.release();
+        assert(1 == SharedPtrHolderRegistry::GetInstance().getHolders(&*trackedSharedPtr).size());
+    }
+
+    assert(0 == Base::getCountOfAliveInstances());
+#endif
+
     return 0;
 }